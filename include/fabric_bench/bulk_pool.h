@@ -0,0 +1,87 @@
+//
+// Created by lukemartinlogan on 10/17/23.
+//
+
+#ifndef FABRIC_INCLUDE_FABRIC_BENCH_BULK_POOL_H_
+#define FABRIC_INCLUDE_FABRIC_BENCH_BULK_POOL_H_
+
+#include <thallium.hpp>
+#include "hermes_shm/util/logging.h"
+#include "page_buffer.h"
+
+#include <mutex>
+#include <vector>
+
+namespace tl = thallium;
+
+/** A region of a BulkPool, exposed once for reads & writes */
+struct BulkRegion {
+  char *data_;     /**< Start of the region */
+  size_t size_;    /**< Capacity of the region */
+  tl::bulk bulk_;  /**< The exposed handle */
+};
+
+/**
+ * Long-lived bulk regions which are exposed (registered) once, up front.
+ * A transfer borrows a region instead of exposing its own buffer,
+ * copying through it if needed. Transfers larger than a region, or made
+ * while every region is borrowed, fall back to exposing per call.
+ * */
+class BulkPool {
+ public:
+  PageBuffer data_;                  /**< Backing store of all regions */
+  std::vector<BulkRegion> regions_;  /**< All regions */
+  std::vector<BulkRegion*> free_;    /**< Regions not borrowed */
+  std::mutex lock_;                  /**< Protects free_ & the counters */
+  size_t region_size_ = 0;           /**< Largest transfer the pool takes */
+  size_t borrows_ = 0, misses_ = 0;
+
+ public:
+  /** Expose "count" regions of "region_size" bytes through "engine" */
+  bool Init(tl::engine &engine, size_t count, size_t region_size,
+            PageKind kind = PageKind::kSmall) {
+    region_size_ = region_size;
+    if (!data_.Allocate(count * region_size, kind)) {
+      return false;
+    }
+    regions_.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+      char *data = data_.data() + i * region_size;
+      std::vector<std::pair<void*, size_t>> segments(1);
+      segments[0].first = data;
+      segments[0].second = region_size;
+      regions_.emplace_back(BulkRegion{
+          data, region_size,
+          engine.expose(segments, tl::bulk_mode::read_write)});
+    }
+    for (BulkRegion &region : regions_) {
+      free_.push_back(&region);
+    }
+    HILOG(kInfo, "Exposed {} bulk regions of {} bytes", count, region_size);
+    return true;
+  }
+
+  /** Borrow a region for a transfer of "size" bytes, or nullptr */
+  BulkRegion* Borrow(size_t size) {
+    if (size > region_size_) {
+      return nullptr;
+    }
+    std::lock_guard<std::mutex> guard(lock_);
+    if (free_.empty()) {
+      misses_ += 1;
+      return nullptr;
+    }
+    borrows_ += 1;
+    BulkRegion *region = free_.back();
+    free_.pop_back();
+    return region;
+  }
+
+  /** Give a borrowed region back */
+  void Return(BulkRegion *region) {
+    std::lock_guard<std::mutex> guard(lock_);
+    free_.push_back(region);
+  }
+};
+
+#endif  // FABRIC_INCLUDE_FABRIC_BENCH_BULK_POOL_H_
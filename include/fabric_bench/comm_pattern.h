@@ -0,0 +1,79 @@
+//
+// Created by lukemartinlogan on 10/17/23.
+//
+
+#ifndef FABRIC_INCLUDE_FABRIC_BENCH_COMM_PATTERN_H_
+#define FABRIC_INCLUDE_FABRIC_BENCH_COMM_PATTERN_H_
+
+#include "hermes_shm/util/logging.h"
+
+#include <string>
+
+/** Which rank talks to which in a multi-process benchmark */
+enum class CommPattern : int {
+  kPairwise = 0,  /**< Ranks 2i and 2i+1 send to each other */
+  kRing = 1,      /**< Rank i sends to i+1 */
+  kShift = 2,     /**< Round k: rank i sends to i+k, timed per k */
+  kAllToAll = 3,  /**< Every shift, timed as one exchange */
+};
+
+/**
+ * A pattern as a sequence of rounds. In each round a rank sends to at
+ * most one destination, and each rank receives from at most one source,
+ * so every RDM server only ever serves one client at a time.
+ * */
+struct CommSchedule {
+  CommPattern pattern_;
+  int nprocs_;
+
+  /** Parse "pairwise", "ring", "shift" or "alltoall" */
+  static CommPattern ParsePattern(const std::string &name) {
+    if (name == "pairwise") {
+      return CommPattern::kPairwise;
+    } else if (name == "ring") {
+      return CommPattern::kRing;
+    } else if (name == "shift") {
+      return CommPattern::kShift;
+    } else if (name == "alltoall") {
+      return CommPattern::kAllToAll;
+    }
+    HELOG(kFatal, "Unknown communication pattern: {}", name);
+    return CommPattern::kPairwise;
+  }
+
+  /** Number of rounds */
+  int NumRounds() const {
+    switch (pattern_) {
+      case CommPattern::kPairwise:
+      case CommPattern::kRing: return nprocs_ > 1 ? 1 : 0;
+      case CommPattern::kShift:
+      case CommPattern::kAllToAll: return nprocs_ - 1;
+    }
+    return 0;
+  }
+
+  /** Whether all rounds are timed together as one exchange */
+  bool Aggregate() const {
+    return pattern_ == CommPattern::kAllToAll;
+  }
+
+  /** The rank "rank" sends to in "round" (-1 if none) */
+  int Dest(int round, int rank) const {
+    switch (pattern_) {
+      case CommPattern::kPairwise: {
+        int peer = rank ^ 1;
+        return peer < nprocs_ ? peer : -1;
+      }
+      case CommPattern::kRing: {
+        return (rank + 1) % nprocs_;
+      }
+      case CommPattern::kShift:
+      case CommPattern::kAllToAll: {
+        return (rank + round + 1) % nprocs_;
+      }
+    }
+    return -1;
+  }
+};
+
+#endif  // FABRIC_INCLUDE_FABRIC_BENCH_COMM_PATTERN_H_
@@ -7,12 +7,14 @@
 
 #include <yaml-cpp/yaml.h>
 #include "hermes_shm/util/config_parse.h"
+#include "hermes_shm/constants/macros.h"
 
 #include <netdb.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <ifaddrs.h>
 #include <arpa/inet.h>
+#include <thread>
 
 class ConfigManager {
  public:
@@ -21,6 +23,64 @@ class ConfigManager {
   std::string domain_;
   std::string protocol_;
   std::string my_ip_;
+  size_t min_msg_size_ = 1;            /**< Smallest message in a sweep */
+  size_t max_msg_size_ = MEGABYTES(4); /**< Largest message in a sweep */
+  size_t warmup_ = 100;                /**< Untimed iterations per size */
+  size_t iterations_ = 1000;           /**< Timed iterations per size */
+  std::vector<size_t> windows_ = {1, 16, 64};  /**< Sends in flight */
+  std::vector<std::string> cq_policies_ = {"busy"};  /**< CQ wait policies */
+  size_t cq_spin_us_ = 10;             /**< Spin budget of "hybrid" */
+  size_t num_clients_ = 1;       /**< Clients the server waits for (0 = any) */
+  size_t progress_threads_ = 1;  /**< Server threads serving connections */
+  bool server_poll_all_ = false; /**< Server workers never block on one CQ */
+  std::string shard_mode_;       /**< "endpoint" or "domain" (empty = off) */
+  size_t max_threads_ = 0;       /**< Largest sharded thread count (0 = cores) */
+  bool pin_threads_ = false;     /**< Pin sharded threads to cores */
+  std::vector<size_t> incast_clients_;  /**< Incast client counts (empty = off) */
+  bool rma_ = false;             /**< Request FI_RMA & run RMA benchmarks */
+  size_t rma_region_size_ = MEGABYTES(4);  /**< Size of the RMA region */
+  size_t mr_cache_bytes_ = MEGABYTES(256); /**< Registration cache cap */
+  size_t mr_bench_buffers_ = 0;  /**< User buffers for the MR benchmark */
+  std::string page_size_ = "4k"; /**< Payload pages: "4k", "2m" or "1g" */
+  bool inject_ = false;          /**< Inject small sends in all benchmarks */
+  bool inject_bench_ = false;    /**< Compare inject & regular send rates */
+  std::string ep_type_ = "msg";  /**< "msg" (connected) or "rdm" */
+  bool cntr_bench_ = false;      /**< Compare counter & CQ completions */
+  size_t rpc_threads_ = 4;          /**< Thallium handler xstreams */
+  bool rpc_progress_thread_ = true; /**< Dedicated progress xstream */
+  bool rpc_busy_spin_ = false;      /**< Poll for progress instead of blocking */
+  std::string rpc_pool_kind_;       /**< "fifo_wait", "fifo" or "prio_wait" */
+  std::vector<size_t> rpc_sweep_threads_;  /**< Handler counts to sweep */
+  int rpc_sweep_port_ = 0;          /**< Sweep server port (0 = port + 1) */
+  std::vector<size_t> sg_segments_ = {4, 64};  /**< Scatter-gather counts */
+  size_t bulk_pool_regions_ = 16;          /**< Pre-exposed Thallium regions */
+  size_t bulk_pool_size_ = MEGABYTES(1);   /**< Size of each such region */
+  size_t bulk_chunk_size_ = MEGABYTES(1);  /**< Pipelined transfer chunk */
+  size_t bulk_chunk_depth_ = 4;            /**< Chunks in flight */
+  std::vector<size_t> rpc_batch_calls_ = {1, 16, 64};  /**< Calls per batch */
+  std::vector<size_t> rpc_batch_deadlines_us_ = {10, 100};  /**< Max wait */
+  size_t rpc_batch_bytes_ = KILOBYTES(64);  /**< Argument bytes per batch */
+  size_t rpc_batch_payload_ = 64;           /**< Bytes per batched call */
+  std::vector<std::string> harness_providers_;  /**< Empty = protocol_ */
+  std::vector<std::string> harness_transports_ =
+      {"msg", "rma", "rdm", "thallium"};   /**< Transports of the harness */
+  std::string harness_output_;             /**< Harness CSV (empty = stdout) */
+  bool matrix_ = false;                    /**< Run the benchmark matrix */
+  std::vector<size_t> matrix_sizes_;       /**< Empty = min..max_msg_size */
+  std::vector<size_t> matrix_windows_;     /**< Empty = windows */
+  std::vector<size_t> matrix_threads_;     /**< Empty = {1} */
+  std::vector<size_t> matrix_iterations_;  /**< Empty = {iterations} */
+  std::vector<std::string> mpi_patterns_ =
+      {"pairwise", "ring", "shift", "alltoall"};  /**< mpi_bench patterns */
+  std::vector<size_t> probe_sizes_;  /**< Size classes (empty = defaults) */
+  size_t probe_iterations_ = 100;    /**< Messages per probe measurement */
+  std::string provider_table_;       /**< Ranking written by provider_probe */
+  size_t auto_msg_size_ = KILOBYTES(4);  /**< Size class "auto" picks for */
+  int route_port_ = 0;               /**< First "auto" route (0 = port + 2) */
+  bool multi_recv_ = false;      /**< Server receives into FI_MULTI_RECV bufs */
+  size_t multi_recv_size_ = MEGABYTES(16);  /**< Size of each such buffer */
+  size_t multi_recv_count_ = 2;  /**< Multi-receive buffers per client */
+  bool multi_recv_compare_ = false;  /**< Incast over both receive modes */
 
  public:
   void Load(const std::string &path) {
@@ -53,10 +113,325 @@ class ConfigManager {
     if (yaml_conf["port"]) {
       port_ = yaml_conf["port"].as<int>();
     }
+    if (yaml_conf["min_msg_size"]) {
+      min_msg_size_ = hshm::ConfigParse::ParseSize(
+          yaml_conf["min_msg_size"].as<std::string>());
+    }
+    if (yaml_conf["max_msg_size"]) {
+      max_msg_size_ = hshm::ConfigParse::ParseSize(
+          yaml_conf["max_msg_size"].as<std::string>());
+    }
+    if (yaml_conf["warmup"]) {
+      warmup_ = yaml_conf["warmup"].as<size_t>();
+    }
+    if (yaml_conf["iterations"]) {
+      iterations_ = yaml_conf["iterations"].as<size_t>();
+    }
+    if (yaml_conf["windows"]) {
+      windows_ = yaml_conf["windows"].as<std::vector<size_t>>();
+    }
+    if (yaml_conf["cq_policies"]) {
+      cq_policies_ = yaml_conf["cq_policies"].as<std::vector<std::string>>();
+    }
+    if (yaml_conf["cq_spin_us"]) {
+      cq_spin_us_ = yaml_conf["cq_spin_us"].as<size_t>();
+    }
+    if (yaml_conf["num_clients"]) {
+      num_clients_ = yaml_conf["num_clients"].as<size_t>();
+    }
+    if (yaml_conf["progress_threads"]) {
+      progress_threads_ = yaml_conf["progress_threads"].as<size_t>();
+    }
+    if (yaml_conf["shard_mode"]) {
+      shard_mode_ = yaml_conf["shard_mode"].as<std::string>();
+    }
+    if (yaml_conf["max_threads"]) {
+      max_threads_ = yaml_conf["max_threads"].as<size_t>();
+    }
+    if (yaml_conf["pin_threads"]) {
+      pin_threads_ = yaml_conf["pin_threads"].as<bool>();
+    }
+    if (yaml_conf["rma"]) {
+      rma_ = yaml_conf["rma"].as<bool>();
+    }
+    if (yaml_conf["inject"]) {
+      inject_ = yaml_conf["inject"].as<bool>();
+    }
+    if (yaml_conf["inject_bench"]) {
+      inject_bench_ = yaml_conf["inject_bench"].as<bool>();
+    }
+    if (yaml_conf["ep_type"]) {
+      ep_type_ = yaml_conf["ep_type"].as<std::string>();
+    }
+    if (yaml_conf["rpc_threads"]) {
+      rpc_threads_ = yaml_conf["rpc_threads"].as<size_t>();
+    }
+    if (yaml_conf["rpc_progress_thread"]) {
+      rpc_progress_thread_ = yaml_conf["rpc_progress_thread"].as<bool>();
+    }
+    if (yaml_conf["rpc_busy_spin"]) {
+      rpc_busy_spin_ = yaml_conf["rpc_busy_spin"].as<bool>();
+    }
+    if (yaml_conf["rpc_pool_kind"]) {
+      rpc_pool_kind_ = yaml_conf["rpc_pool_kind"].as<std::string>();
+    }
+    if (yaml_conf["rpc_sweep_threads"]) {
+      rpc_sweep_threads_ =
+          yaml_conf["rpc_sweep_threads"].as<std::vector<size_t>>();
+    }
+    if (yaml_conf["rpc_sweep_port"]) {
+      rpc_sweep_port_ = yaml_conf["rpc_sweep_port"].as<int>();
+    }
+    if (yaml_conf["sg_segments"]) {
+      sg_segments_ = yaml_conf["sg_segments"].as<std::vector<size_t>>();
+    }
+    if (yaml_conf["bulk_pool_regions"]) {
+      bulk_pool_regions_ = yaml_conf["bulk_pool_regions"].as<size_t>();
+    }
+    if (yaml_conf["bulk_pool_size"]) {
+      bulk_pool_size_ = hshm::ConfigParse::ParseSize(
+          yaml_conf["bulk_pool_size"].as<std::string>());
+    }
+    if (yaml_conf["bulk_chunk_size"]) {
+      bulk_chunk_size_ = hshm::ConfigParse::ParseSize(
+          yaml_conf["bulk_chunk_size"].as<std::string>());
+    }
+    if (yaml_conf["bulk_chunk_depth"]) {
+      bulk_chunk_depth_ = yaml_conf["bulk_chunk_depth"].as<size_t>();
+    }
+    if (yaml_conf["rpc_batch_calls"]) {
+      rpc_batch_calls_ = yaml_conf["rpc_batch_calls"].as<std::vector<size_t>>();
+    }
+    if (yaml_conf["rpc_batch_deadlines_us"]) {
+      rpc_batch_deadlines_us_ =
+          yaml_conf["rpc_batch_deadlines_us"].as<std::vector<size_t>>();
+    }
+    if (yaml_conf["rpc_batch_bytes"]) {
+      rpc_batch_bytes_ = hshm::ConfigParse::ParseSize(
+          yaml_conf["rpc_batch_bytes"].as<std::string>());
+    }
+    if (yaml_conf["rpc_batch_payload"]) {
+      rpc_batch_payload_ = yaml_conf["rpc_batch_payload"].as<size_t>();
+    }
+    if (yaml_conf["harness_providers"]) {
+      harness_providers_ =
+          yaml_conf["harness_providers"].as<std::vector<std::string>>();
+    }
+    if (yaml_conf["harness_transports"]) {
+      harness_transports_ =
+          yaml_conf["harness_transports"].as<std::vector<std::string>>();
+    }
+    if (yaml_conf["probe_sizes"]) {
+      probe_sizes_.clear();
+      for (YAML::Node size : yaml_conf["probe_sizes"]) {
+        probe_sizes_.push_back(
+            hshm::ConfigParse::ParseSize(size.as<std::string>()));
+      }
+    }
+    if (yaml_conf["probe_iterations"]) {
+      probe_iterations_ = yaml_conf["probe_iterations"].as<size_t>();
+    }
+    if (yaml_conf["provider_table"]) {
+      provider_table_ = yaml_conf["provider_table"].as<std::string>();
+    }
+    if (yaml_conf["auto_msg_size"]) {
+      auto_msg_size_ = hshm::ConfigParse::ParseSize(
+          yaml_conf["auto_msg_size"].as<std::string>());
+    }
+    if (yaml_conf["route_port"]) {
+      route_port_ = yaml_conf["route_port"].as<int>();
+    }
+    if (yaml_conf["harness_output"]) {
+      harness_output_ = yaml_conf["harness_output"].as<std::string>();
+    }
+    if (yaml_conf["mpi_patterns"]) {
+      mpi_patterns_ = yaml_conf["mpi_patterns"].as<std::vector<std::string>>();
+    }
+    if (yaml_conf["server_poll_all"]) {
+      server_poll_all_ = yaml_conf["server_poll_all"].as<bool>();
+    }
+    if (yaml_conf["incast_clients"]) {
+      incast_clients_ = yaml_conf["incast_clients"].as<std::vector<size_t>>();
+    }
+    if (yaml_conf["cntr_bench"]) {
+      cntr_bench_ = yaml_conf["cntr_bench"].as<bool>();
+    }
+    if (yaml_conf["multi_recv"]) {
+      multi_recv_ = yaml_conf["multi_recv"].as<bool>();
+    }
+    if (yaml_conf["multi_recv_size"]) {
+      multi_recv_size_ = hshm::ConfigParse::ParseSize(
+          yaml_conf["multi_recv_size"].as<std::string>());
+    }
+    if (yaml_conf["multi_recv_count"]) {
+      multi_recv_count_ = yaml_conf["multi_recv_count"].as<size_t>();
+    }
+    if (yaml_conf["multi_recv_compare"]) {
+      multi_recv_compare_ = yaml_conf["multi_recv_compare"].as<bool>();
+    }
+    if (yaml_conf["page_size"]) {
+      page_size_ = yaml_conf["page_size"].as<std::string>();
+    }
+    if (yaml_conf["mr_cache_bytes"]) {
+      mr_cache_bytes_ = hshm::ConfigParse::ParseSize(
+          yaml_conf["mr_cache_bytes"].as<std::string>());
+    }
+    if (yaml_conf["mr_bench_buffers"]) {
+      mr_bench_buffers_ = yaml_conf["mr_bench_buffers"].as<size_t>();
+    }
+    if (yaml_conf["rma_region_size"]) {
+      rma_region_size_ = hshm::ConfigParse::ParseSize(
+          yaml_conf["rma_region_size"].as<std::string>());
+    }
+
+    if (yaml_conf["matrix"]) {
+      ParseMatrix(yaml_conf["matrix"]);
+    }
 
+    _Validate();
     _FindThisHost();
   }
 
+  /**
+   * Check the settings the benchmarks index without checking, such as
+   * the last window or the first CQ policy
+   * */
+  void _Validate() {
+    if (windows_.empty()) {
+      HELOG(kFatal, "windows must list at least one window");
+    }
+    if (cq_policies_.empty()) {
+      HELOG(kFatal, "cq_policies must list at least one policy");
+    }
+  }
+
+  /**
+   * Parse the benchmark matrix. Its providers and ep_types replace
+   * harness_providers and harness_transports, so the harness servers
+   * start one server per (provider, ep_type) pair.
+   * */
+  void ParseMatrix(YAML::Node matrix) {
+    matrix_ = true;
+    if (matrix["msg_sizes"]) {
+      matrix_sizes_.clear();
+      for (YAML::Node size : matrix["msg_sizes"]) {
+        matrix_sizes_.push_back(
+            hshm::ConfigParse::ParseSize(size.as<std::string>()));
+      }
+    }
+    if (matrix["windows"]) {
+      matrix_windows_ = matrix["windows"].as<std::vector<size_t>>();
+    }
+    if (matrix["threads"]) {
+      matrix_threads_ = matrix["threads"].as<std::vector<size_t>>();
+    }
+    if (matrix["iterations"]) {
+      matrix_iterations_ = matrix["iterations"].as<std::vector<size_t>>();
+    }
+    if (matrix["providers"]) {
+      harness_providers_ = matrix["providers"].as<std::vector<std::string>>();
+    }
+    if (matrix["ep_types"]) {
+      harness_transports_ =
+          matrix["ep_types"].as<std::vector<std::string>>();
+    }
+  }
+
+  /** Message sizes to sweep: powers of two from min to max */
+  std::vector<size_t> GetMsgSizes() {
+    std::vector<size_t> sizes;
+    for (size_t size = std::max<size_t>(min_msg_size_, 1);
+         size <= max_msg_size_; size *= 2) {
+      sizes.push_back(size);
+    }
+    return sizes;
+  }
+
+  /** Thread counts to sweep: powers of two up to max_threads_ */
+  std::vector<size_t> GetThreadCounts() {
+    size_t max_threads = max_threads_ ? max_threads_ :
+        std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    std::vector<size_t> counts;
+    for (size_t count = 1; count < max_threads; count *= 2) {
+      counts.push_back(count);
+    }
+    counts.push_back(max_threads);
+    return counts;
+  }
+
+  /** Message sizes of the matrix */
+  std::vector<size_t> GetMatrixSizes() {
+    return matrix_sizes_.empty() ? GetMsgSizes() : matrix_sizes_;
+  }
+
+  /** Window depths of the matrix */
+  std::vector<size_t> GetMatrixWindows() {
+    return matrix_windows_.empty() ? windows_ : matrix_windows_;
+  }
+
+  /** Thread counts of the matrix */
+  std::vector<size_t> GetMatrixThreads() {
+    return matrix_threads_.empty() ? std::vector<size_t>{1} : matrix_threads_;
+  }
+
+  /** Iteration counts of the matrix */
+  std::vector<size_t> GetMatrixIterations() {
+    return matrix_iterations_.empty() ? std::vector<size_t>{iterations_} :
+        matrix_iterations_;
+  }
+
+  /**
+   * Size classes the provider probe ranks: small, eager, rendezvous and
+   * bulk messages, up to max_msg_size_
+   * */
+  std::vector<size_t> GetProbeSizes() {
+    if (!probe_sizes_.empty()) {
+      return probe_sizes_;
+    }
+    std::vector<size_t> sizes;
+    for (size_t size : {(size_t)64, KILOBYTES(4), KILOBYTES(64),
+                        MEGABYTES(1)}) {
+      if (size <= max_msg_size_) {
+        sizes.push_back(size);
+      }
+    }
+    return sizes;
+  }
+
+  /**
+   * Port of the in-process server of the RPC topology sweep, kept apart
+   * from a thallium_server running on port_
+   * */
+  int GetRpcSweepPort() {
+    return rpc_sweep_port_ ? rpc_sweep_port_ : port_ + 1;
+  }
+
+  /**
+   * Port of the "route_idx"th provider route of protocol "auto". Routes
+   * follow port (the auto_msg_size provider) & port + 1 (multi_recv
+   * comparison).
+   * */
+  int GetRoutePort(size_t route_idx) {
+    return (route_port_ ? route_port_ : port_ + 2) + (int)route_idx;
+  }
+
+  /** Providers the harness runs over */
+  std::vector<std::string> GetHarnessProviders() {
+    if (harness_providers_.empty()) {
+      return {protocol_};
+    }
+    return harness_providers_;
+  }
+
+  /**
+   * Port of one harness point: each (provider, transport) pair gets its
+   * own server, on consecutive ports starting at port_.
+   * */
+  int GetHarnessPort(size_t provider_idx, size_t transport_idx) {
+    return port_ + (int)(provider_idx * harness_transports_.size() +
+                         transport_idx);
+  }
+
   /** Get the node ID of this machine according to hostfile */
   int _FindThisHost() {
     int node_id = 1;
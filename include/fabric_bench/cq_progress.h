@@ -0,0 +1,143 @@
+//
+// Created by lukemartinlogan on 10/17/23.
+//
+
+#ifndef FABRIC_INCLUDE_FABRIC_BENCH_CQ_PROGRESS_H_
+#define FABRIC_INCLUDE_FABRIC_BENCH_CQ_PROGRESS_H_
+
+#include "hermes_shm/util/logging.h"
+#include "histogram.h"
+
+#include <string>
+#include <vector>
+
+#include <rdma/fabric.h>
+#include <rdma/fi_domain.h>
+
+/** How a thread waits for completions */
+enum class CqPolicy : int {
+  kBusyPoll = 0,  /**< Spin on fi_cq_read */
+  kBlocking = 1,  /**< Sleep in fi_cq_sread */
+  kHybrid = 2,    /**< Spin for spin_nsec_, then sleep in fi_cq_sread */
+};
+
+/** Waits on a completion queue according to a CqPolicy */
+struct CqProgress {
+  CqPolicy policy_ = CqPolicy::kBusyPoll;
+  uint64_t spin_nsec_ = 10000;  /**< Spin budget for kHybrid */
+  int timeout_ms_ = -1;         /**< Max time to sleep (-1 = forever) */
+
+  /** Parse "busy", "sread", or "hybrid" */
+  static CqPolicy ParsePolicy(const std::string &name) {
+    if (name == "busy") {
+      return CqPolicy::kBusyPoll;
+    } else if (name == "sread") {
+      return CqPolicy::kBlocking;
+    } else if (name == "hybrid") {
+      return CqPolicy::kHybrid;
+    }
+    HELOG(kFatal, "Unknown CQ policy: {}", name);
+    return CqPolicy::kBusyPoll;
+  }
+
+  /** Name of a policy */
+  static const char* PolicyName(CqPolicy policy) {
+    switch (policy) {
+      case CqPolicy::kBusyPoll: return "busy";
+      case CqPolicy::kBlocking: return "sread";
+      case CqPolicy::kHybrid: return "hybrid";
+    }
+    return "unknown";
+  }
+
+  /**
+   * The CQ wait object a policy needs. fi_cq_sread is not supported on
+   * FI_WAIT_NONE queues.
+   * */
+  static enum fi_wait_obj WaitObj(CqPolicy policy) {
+    return policy == CqPolicy::kBusyPoll ? FI_WAIT_NONE : FI_WAIT_UNSPEC;
+  }
+
+  /** The CQ wait object needed to support every policy in "names" */
+  static enum fi_wait_obj WaitObj(const std::vector<std::string> &names) {
+    for (const std::string &name : names) {
+      if (ParsePolicy(name) != CqPolicy::kBusyPoll) {
+        return FI_WAIT_UNSPEC;
+      }
+    }
+    return FI_WAIT_NONE;
+  }
+
+  /**
+   * Wait until "cntr" reaches "target" & store its value in "count".
+   * Returns a negative fi_errno if any counted operation failed.
+   * */
+  int WaitCntr(struct fid_cntr *cntr, uint64_t target, size_t &count) {
+    uint64_t deadline = NowNsec() + spin_nsec_;
+    while (true) {
+      count = fi_cntr_read(cntr);
+      if (count >= target) {
+        return 0;
+      }
+      if (fi_cntr_readerr(cntr)) {
+        return -FI_EOTHER;
+      }
+      if (policy_ == CqPolicy::kBlocking ||
+          (policy_ == CqPolicy::kHybrid && NowNsec() >= deadline)) {
+        int ret = fi_cntr_wait(cntr, target, -1);
+        if (ret && ret != -FI_ETIMEDOUT) {
+          return ret;
+        }
+      }
+    }
+  }
+
+  /**
+   * Block until at least one completion (or error) is available.
+   * Returns the number of entries read or a negative fi_errno.
+   * */
+  ssize_t Wait(struct fid_cq *cq, void *buf, size_t count) {
+    ssize_t ret;
+    switch (policy_) {
+      case CqPolicy::kBusyPoll: {
+        do {
+          ret = fi_cq_read(cq, buf, count);
+        } while (ret == -FI_EAGAIN);
+        return ret;
+      }
+      case CqPolicy::kBlocking: {
+        return Sleep(cq, buf, count);
+      }
+      case CqPolicy::kHybrid: {
+        uint64_t deadline = NowNsec() + spin_nsec_;
+        do {
+          ret = fi_cq_read(cq, buf, count);
+          if (ret != -FI_EAGAIN) {
+            return ret;
+          }
+        } while (NowNsec() < deadline);
+        return Sleep(cq, buf, count);
+      }
+    }
+    return -FI_EINVAL;
+  }
+
+ private:
+  /**
+   * Sleep in fi_cq_sread until something completes. With a timeout,
+   * returns -FI_EAGAIN once it expires so the caller can check whether
+   * to keep waiting.
+   * */
+  ssize_t Sleep(struct fid_cq *cq, void *buf, size_t count) {
+    ssize_t ret;
+    do {
+      ret = fi_cq_sread(cq, buf, count, NULL, timeout_ms_);
+      if (ret == -FI_ETIMEDOUT) {
+        ret = -FI_EAGAIN;
+      }
+    } while (ret == -FI_EAGAIN && timeout_ms_ < 0);
+    return ret;
+  }
+};
+
+#endif  // FABRIC_INCLUDE_FABRIC_BENCH_CQ_PROGRESS_H_
@@ -0,0 +1,342 @@
+//
+// Created by lukemartinlogan on 10/17/23.
+//
+
+#ifndef FABRIC_INCLUDE_FABRIC_BENCH_HARNESS_H_
+#define FABRIC_INCLUDE_FABRIC_BENCH_HARNESS_H_
+
+#include "config_manager.h"
+#include "socket_client.h"
+#include "msg_bench.h"
+#include "rdma_client.h"
+#include "rpc_thallium.h"
+#include "histogram.h"
+#include "run_together.h"
+
+#include <deque>
+#include <string>
+#include <thread>
+
+#include <rdma/fi_errno.h>
+#include <sys/utsname.h>
+
+/**
+ * One transport under the unified harness. Every transport answers the
+ * same two questions, so the same suite runs over all of them: how long
+ * one op of "size" bytes takes, and how long "iters" ops take with up to
+ * "window" in flight.
+ * */
+class HarnessTransport {
+ public:
+  virtual ~HarnessTransport() = default;
+
+  /** Time one op at a time, each waited for before the next */
+  virtual int Latency(size_t size, size_t warmup, size_t iters,
+                      LatencyHistogram &hist) = 0;
+
+  /** Keep up to "window" ops in flight; "nsec" is the total time */
+  virtual int Bandwidth(size_t size, size_t window, size_t iters,
+                        uint64_t &nsec) = 0;
+
+  /** Largest op the transport can run */
+  virtual size_t MaxSize() = 0;
+
+  /** Tell the server this client is done */
+  virtual int Stop() = 0;
+};
+
+/** Two-sided messages over a SocketClient (MSG or RDM) */
+class MsgTransport : public HarnessTransport {
+ public:
+  SocketClient *conn_;
+  MsgBenchClient bench_;
+
+ public:
+  explicit MsgTransport(SocketClient *conn) : conn_(conn), bench_(conn) {}
+
+  int Latency(size_t size, size_t warmup, size_t iters,
+              LatencyHistogram &hist) override {
+    return bench_.PingPong(size, warmup, iters, hist);
+  }
+
+  int Bandwidth(size_t size, size_t window, size_t iters,
+                uint64_t &nsec) override {
+    return bench_.Stream(size, window, iters, nsec);
+  }
+
+  size_t MaxSize() override {
+    return conn_->max_msg_size_;
+  }
+
+  int Stop() override {
+    return bench_.Stop();
+  }
+};
+
+/** One-sided fi_write into the server's region */
+class RmaTransport : public HarnessTransport {
+ public:
+  RdmaClient *rdma_;
+
+ public:
+  explicit RmaTransport(RdmaClient *rdma) : rdma_(rdma) {}
+
+  int Latency(size_t size, size_t warmup, size_t iters,
+              LatencyHistogram &hist) override {
+    return rdma_->Latency(true, size, warmup, iters, hist);
+  }
+
+  int Bandwidth(size_t size, size_t window, size_t iters,
+                uint64_t &nsec) override {
+    return rdma_->Bandwidth(true, size, window, iters, nsec);
+  }
+
+  size_t MaxSize() override {
+    return std::min(rdma_->remote_.size_, rdma_->data_.size());
+  }
+
+  int Stop() override {
+    return MsgBenchClient(rdma_->conn_).Stop();
+  }
+};
+
+/**
+ * Thallium "Write" RPCs, each pulling "size" bytes from the client with
+ * a bulk transfer. The client's buffer is exposed once, as the libfabric
+ * transports register theirs once, and every call of both the latency
+ * and the bandwidth tests passes that same bulk.
+ * */
+class ThalliumTransport : public HarnessTransport {
+ public:
+  labstor::ThalliumRpc *rpc_;
+  labstor::u32 node_id_;
+  std::vector<char> data_;
+  tl::bulk bulk_;  /**< data_, exposed for the server to pull */
+
+ public:
+  ThalliumTransport(labstor::ThalliumRpc *rpc, labstor::u32 node_id,
+                    size_t max_size)
+      : rpc_(rpc), node_id_(node_id), data_(max_size) {
+    bulk_ = rpc_->Expose(data_.data(), data_.size(),
+                         labstor::IoType::kWrite);
+  }
+
+  int Latency(size_t size, size_t warmup, size_t iters,
+              LatencyHistogram &hist) override {
+    hist.Reset();
+    for (size_t i = 0; i < warmup + iters; ++i) {
+      uint64_t start = NowNsec();
+      tl::async_response resp = Write(size);
+      size_t io_bytes = rpc_->Wait<size_t>(resp);
+      if (io_bytes != size) {
+        HELOG(kError, "Write moved {} of {} bytes", io_bytes, size);
+        return -FI_EIO;
+      }
+      if (i >= warmup) {
+        hist.Record(NowNsec() - start);
+      }
+    }
+    return 0;
+  }
+
+  int Bandwidth(size_t size, size_t window, size_t iters,
+                uint64_t &nsec) override {
+    std::deque<tl::async_response> inflight;
+    window = std::max<size_t>(window, 1);
+    uint64_t start = NowNsec();
+    for (size_t i = 0; i < iters; ++i) {
+      if (inflight.size() == window) {
+        rpc_->Wait<size_t>(inflight.front());
+        inflight.pop_front();
+      }
+      inflight.emplace_back(Write(size));
+    }
+    for (tl::async_response &resp : inflight) {
+      rpc_->Wait<size_t>(resp);
+    }
+    nsec = std::max<uint64_t>(NowNsec() - start, 1);
+    return 0;
+  }
+
+  size_t MaxSize() override {
+    return data_.size();
+  }
+
+  int Stop() override {
+    tl::async_response resp = rpc_->AsyncCall(node_id_, "Stop");
+    rpc_->Wait<int>(resp);
+    return 0;
+  }
+
+ private:
+  /** Have the server pull the first "size" bytes of bulk_ */
+  tl::async_response Write(size_t size) {
+    return rpc_->AsyncCall(node_id_, "Write", bulk_, size, true);
+  }
+};
+
+/** One result of the harness suite */
+struct HarnessRow {
+  std::string transport_;  /**< "msg", "rma", "rdm" or "thallium" */
+  std::string provider_;   /**< Libfabric provider / Mercury protocol */
+  std::string metric_;     /**< "latency", "bandwidth" or "msg_rate" */
+  size_t size_ = 0;        /**< Bytes per op */
+  size_t window_ = 1;      /**< Ops in flight */
+  size_t threads_ = 1;     /**< Threads, each on its own connection */
+  size_t iters_ = 0;       /**< Timed ops */
+  double p50_us_ = 0, p99_us_ = 0;  /**< Latency percentiles */
+  double gbps_ = 0;        /**< GB/s */
+  double mops_ = 0;        /**< Million ops per second */
+};
+
+/**
+ * Writes harness results as CSV. Every row repeats the environment
+ * (host, kernel, cores, libfabric version) and the config it ran under,
+ * so rows from different hosts and runs can simply be concatenated.
+ * */
+class HarnessReport {
+ public:
+  FILE *out_ = stdout;
+  std::string prefix_;  /**< Environment & config columns of every row */
+
+ public:
+  ~HarnessReport() {
+    if (out_ && out_ != stdout) {
+      fclose(out_);
+    }
+  }
+
+  /** Open "path" (stdout if empty) and write the header */
+  bool Open(const std::string &path, const std::string &config_path,
+            ConfigManager &config) {
+    if (!path.empty()) {
+      out_ = fopen(path.c_str(), "w");
+      if (!out_) {
+        HELOG(kError, "Failed to open {}", path);
+        out_ = stdout;
+        return false;
+      }
+    }
+    char host[256] = {0};
+    gethostname(host, sizeof(host) - 1);
+    struct utsname uts = {};
+    uname(&uts);
+    uint32_t version = fi_version();
+    prefix_ = std::string(host) + "," + uts.release + "," +
+        std::to_string(std::thread::hardware_concurrency()) + "," +
+        std::to_string(FI_MAJOR(version)) + "." +
+        std::to_string(FI_MINOR(version)) + "," + config_path + "," +
+        std::to_string(config.warmup_) + "," + config.page_size_ + "," +
+        config.cq_policies_[0];
+    fprintf(out_, "host,kernel,cores,libfabric,config,warmup,page_size,"
+                  "cq_policy,transport,provider,metric,size,window,threads,"
+                  "iters,p50_us,p99_us,gbps,mops\n");
+    return true;
+  }
+
+  /** Write one result */
+  void Write(const HarnessRow &row) {
+    fprintf(out_, "%s,%s,%s,%s,%zu,%zu,%zu,%zu,%.3f,%.3f,%.3f,%.3f\n",
+            prefix_.c_str(), row.transport_.c_str(), row.provider_.c_str(),
+            row.metric_.c_str(), row.size_, row.window_, row.threads_,
+            row.iters_, row.p50_us_, row.p99_us_, row.gbps_, row.mops_);
+    fflush(out_);
+  }
+};
+
+/**
+ * Run the suite over one transport: latency and bandwidth (at the
+ * deepest window) for every message size, then the message rate of the
+ * smallest size at every window.
+ * */
+static inline int RunHarnessSuite(HarnessTransport &transport,
+                                  HarnessRow row, ConfigManager &config,
+                                  HarnessReport &report) {
+  int ret;
+  LatencyHistogram hist;
+  size_t iters = config.iterations_;
+  row.iters_ = iters;
+  for (size_t size : config.GetMsgSizes()) {
+    if (size > transport.MaxSize()) {
+      break;
+    }
+    ret = transport.Latency(size, config.warmup_, iters, hist);
+    if (ret) {
+      return ret;
+    }
+    row.metric_ = "latency";
+    row.size_ = size;
+    row.window_ = 1;
+    row.p50_us_ = hist.Percentile(50) / 1000.0;
+    row.p99_us_ = hist.Percentile(99) / 1000.0;
+    row.gbps_ = size / std::max<double>(hist.Percentile(50), 1);
+    row.mops_ = 0;
+    report.Write(row);
+  }
+  auto bandwidth = [&](const char *metric, size_t size, size_t window) {
+    uint64_t nsec;
+    int rc = transport.Bandwidth(size, window, config.warmup_, nsec);
+    if (rc == 0) {
+      rc = transport.Bandwidth(size, window, iters, nsec);
+    }
+    if (rc) {
+      return rc;
+    }
+    row.metric_ = metric;
+    row.size_ = size;
+    row.window_ = window;
+    row.p50_us_ = row.p99_us_ = 0;
+    row.gbps_ = static_cast<double>(size) * iters / nsec;
+    row.mops_ = iters * 1000.0 / nsec;
+    report.Write(row);
+    return 0;
+  };
+  for (size_t size : config.GetMsgSizes()) {
+    if (size > transport.MaxSize()) {
+      break;
+    }
+    ret = bandwidth("bandwidth", size, config.windows_.back());
+    if (ret) {
+      return ret;
+    }
+  }
+  for (size_t window : config.windows_) {
+    ret = bandwidth("msg_rate", std::max<size_t>(config.min_msg_size_, 1),
+                    window);
+    if (ret) {
+      return ret;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Concurrent ping-pong on each of "transports", merged into "hist".
+ * Each transport is driven by its own thread.
+ * */
+static inline int HarnessLatency(std::vector<HarnessTransport*> &transports,
+                                 size_t size, size_t warmup, size_t iters,
+                                 LatencyHistogram &hist) {
+  return RunLatencyTogether(transports.size(),
+                            [&](size_t i, LatencyHistogram &thread_hist) {
+    return transports[i]->Latency(size, warmup, iters, thread_hist);
+  }, hist);
+}
+
+/**
+ * Concurrent windowed streams on each of "transports". "nsec" is the
+ * slowest thread's time.
+ * */
+static inline int HarnessBandwidth(std::vector<HarnessTransport*> &transports,
+                                   size_t size, size_t window, size_t iters,
+                                   uint64_t &nsec) {
+  std::vector<uint64_t> nsecs(transports.size(), 0);
+  int ret = RunTogether(transports.size(), [&](size_t i) {
+    return transports[i]->Bandwidth(size, window, iters, nsecs[i]);
+  });
+  nsec = std::max<uint64_t>(
+      *std::max_element(nsecs.begin(), nsecs.end()), 1);
+  return ret;
+}
+
+#endif  // FABRIC_INCLUDE_FABRIC_BENCH_HARNESS_H_
@@ -0,0 +1,160 @@
+//
+// Created by lukemartinlogan on 10/17/23.
+//
+
+#ifndef FABRIC_INCLUDE_FABRIC_BENCH_HISTOGRAM_H_
+#define FABRIC_INCLUDE_FABRIC_BENCH_HISTOGRAM_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <limits>
+#include <vector>
+
+#include <unistd.h>
+
+/**
+ * A log-linear latency histogram (in nanoseconds).
+ *
+ * Each power of two is split into kSubBuckets linear buckets, so recording
+ * is a clz and an increment, and every percentile is within ~3% of the
+ * true value. Min and max are tracked exactly.
+ * */
+class LatencyHistogram {
+ public:
+  static const int kSubBits = 5;
+  static const int kSubBuckets = 1 << kSubBits;
+  static const int kNumBuckets = (64 - kSubBits + 1) * kSubBuckets;
+  std::vector<uint64_t> counts_;  /**< Number of samples per bucket */
+  uint64_t count_;                /**< Total number of samples */
+  uint64_t min_;                  /**< Smallest sample */
+  uint64_t max_;                  /**< Largest sample */
+  uint64_t sum_;                  /**< Sum of all samples */
+
+ public:
+  /** Default constructor */
+  LatencyHistogram() : counts_(kNumBuckets, 0) {
+    Reset();
+  }
+
+  /** Clear all samples */
+  void Reset() {
+    std::fill(counts_.begin(), counts_.end(), 0);
+    count_ = 0;
+    min_ = std::numeric_limits<uint64_t>::max();
+    max_ = 0;
+    sum_ = 0;
+  }
+
+  /** Record a single sample */
+  void Record(uint64_t nsec) {
+    counts_[BucketIndex(nsec)] += 1;
+    count_ += 1;
+    sum_ += nsec;
+    min_ = std::min(min_, nsec);
+    max_ = std::max(max_, nsec);
+  }
+
+  /** Add every sample of "other" */
+  void Merge(const LatencyHistogram &other) {
+    for (int idx = 0; idx < kNumBuckets; ++idx) {
+      counts_[idx] += other.counts_[idx];
+    }
+    count_ += other.count_;
+    sum_ += other.sum_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+  }
+
+  /** Get the value at percentile "pct" (0-100) */
+  uint64_t Percentile(double pct) const {
+    if (count_ == 0) {
+      return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(pct / 100.0 * count_ + .5);
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (int idx = 0; idx < kNumBuckets; ++idx) {
+      seen += counts_[idx];
+      if (seen >= rank) {
+        return std::clamp(BucketValue(idx), min_, max_);
+      }
+    }
+    return max_;
+  }
+
+  /** Smallest sample */
+  uint64_t Min() const {
+    return count_ ? min_ : 0;
+  }
+
+  /** Largest sample */
+  uint64_t Max() const {
+    return max_;
+  }
+
+  /** Average of all samples */
+  double Mean() const {
+    return count_ ? static_cast<double>(sum_) / count_ : 0;
+  }
+
+ private:
+  /** Map a sample to its bucket */
+  static int BucketIndex(uint64_t nsec) {
+    if (nsec < kSubBuckets) {
+      return static_cast<int>(nsec);
+    }
+    int msb = 63 - __builtin_clzll(nsec);
+    int shift = msb - kSubBits;
+    return (shift + 1) * kSubBuckets +
+        static_cast<int>((nsec >> shift) - kSubBuckets);
+  }
+
+  /** Map a bucket to the midpoint of the values it holds */
+  static uint64_t BucketValue(int idx) {
+    if (idx < kSubBuckets) {
+      return idx;
+    }
+    int shift = idx / kSubBuckets - 1;
+    uint64_t base = static_cast<uint64_t>(idx % kSubBuckets + kSubBuckets)
+        << shift;
+    return base + ((1ull << shift) >> 1);
+  }
+};
+
+/** Nanoseconds since an arbitrary fixed point */
+static inline uint64_t NowNsec() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** CPU time consumed by the calling thread, in nanoseconds */
+static inline uint64_t ThreadCpuNsec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+/** CPU time consumed by every thread of this process, in nanoseconds */
+static inline uint64_t ProcessCpuNsec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+/** Resident set size of this process, in bytes */
+static inline size_t ResidentBytes() {
+  size_t pages = 0, resident = 0;
+  FILE *statm = fopen("/proc/self/statm", "r");
+  if (statm) {
+    if (fscanf(statm, "%zu %zu", &pages, &resident) != 2) {
+      resident = 0;
+    }
+    fclose(statm);
+  }
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+#endif  // FABRIC_INCLUDE_FABRIC_BENCH_HISTOGRAM_H_
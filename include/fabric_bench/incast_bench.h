@@ -0,0 +1,104 @@
+//
+// Created by lukemartinlogan on 10/17/23.
+//
+
+#ifndef FABRIC_INCLUDE_FABRIC_BENCH_INCAST_BENCH_H_
+#define FABRIC_INCLUDE_FABRIC_BENCH_INCAST_BENCH_H_
+
+#include "socket_client.h"
+#include "msg_bench.h"
+#include "histogram.h"
+#include "run_together.h"
+
+/**
+ * Many-to-one fan-in: N connections, each with its own fabric, domain
+ * and thread (as if N client processes), all sending to one server at
+ * the same time. The server accepts each into its clients_ list.
+ * */
+struct IncastClient {
+  std::vector<std::unique_ptr<SocketClient>> conns_;
+  PageKind page_kind_ = PageKind::kSmall;  /**< Pages backing payloads */
+  CqProgress progress_;                    /**< How each client waits */
+  enum fi_wait_obj wait_obj_ = FI_WAIT_NONE;  /**< Per-client CQ wait object */
+
+  /** Open connections until there are "num_clients" */
+  int Grow(size_t num_clients, const std::string &provider, int port,
+           const std::string &ip_addr, size_t max_msg_size) {
+    while (conns_.size() < num_clients) {
+      auto conn = std::make_unique<SocketClient>();
+      conn->cq_attr.wait_obj = wait_obj_;
+      conn->progress_ = progress_;
+      conn->page_kind_ = page_kind_;
+      int ret = conn->ClientInit(provider, port, ip_addr);
+      if (ret == 0) {
+        ret = conn->RegisterBuffers(max_msg_size);
+      }
+      if (ret) {
+        HELOG(kError, "Failed to connect incast client {}", conns_.size());
+        return ret;
+      }
+      conns_.emplace_back(std::move(conn));
+    }
+    return 0;
+  }
+
+  /**
+   * All of the first "num_clients" stream "iters" messages at once.
+   * "rates" is each client's messages per second; "nsec" is the time
+   * of the slowest client.
+   * */
+  int Stream(size_t num_clients, size_t msg_size, size_t window,
+             size_t iters, std::vector<double> &rates, uint64_t &nsec) {
+    std::vector<uint64_t> nsecs(num_clients, 0);
+    int ret = RunTogether(num_clients, [&](size_t i) {
+      return MsgBenchClient(conns_[i].get()).Stream(msg_size, window, iters,
+                                                    nsecs[i]);
+    });
+    if (ret) {
+      return ret;
+    }
+    rates.resize(num_clients);
+    nsec = 1;
+    for (size_t i = 0; i < num_clients; ++i) {
+      rates[i] = 1e9 * iters / std::max<uint64_t>(nsecs[i], 1);
+      nsec = std::max(nsec, nsecs[i]);
+    }
+    return 0;
+  }
+
+  /** All of the first "num_clients" ping-pong at once; "hist" merges them */
+  int PingPong(size_t num_clients, size_t msg_size, size_t warmup,
+               size_t iters, LatencyHistogram &hist) {
+    return RunLatencyTogether(num_clients,
+                              [&](size_t i, LatencyHistogram &client_hist) {
+      return MsgBenchClient(conns_[i].get()).PingPong(msg_size, warmup,
+                                                      iters, client_hist);
+    }, hist);
+  }
+
+  /** Tell the server every client is done */
+  int Stop() {
+    for (auto &conn : conns_) {
+      int ret = MsgBenchClient(conn.get()).Stop();
+      if (ret) {
+        return ret;
+      }
+    }
+    return 0;
+  }
+
+  /**
+   * Jain's fairness index of "rates": 1 if every client got the same
+   * share, 1/N if one client got everything.
+   * */
+  static double JainIndex(const std::vector<double> &rates) {
+    double sum = 0, sum_sq = 0;
+    for (double rate : rates) {
+      sum += rate;
+      sum_sq += rate * rate;
+    }
+    return sum_sq > 0 ? sum * sum / (rates.size() * sum_sq) : 0;
+  }
+};
+
+#endif  // FABRIC_INCLUDE_FABRIC_BENCH_INCAST_BENCH_H_
@@ -0,0 +1,118 @@
+//
+// Created by lukemartinlogan on 10/17/23.
+//
+
+#ifndef FABRIC_INCLUDE_FABRIC_BENCH_MR_CACHE_H_
+#define FABRIC_INCLUDE_FABRIC_BENCH_MR_CACHE_H_
+
+#include "hermes_shm/util/logging.h"
+
+#include <list>
+#include <map>
+
+#include <rdma/fabric.h>
+#include <rdma/fi_domain.h>
+
+/**
+ * Caches memory registrations of user buffers, keyed by address range.
+ *
+ * A lookup hits if a cached region starting at or before the buffer
+ * covers all of it. Misses register the buffer and evict the least
+ * recently used regions until the cache fits in max_bytes_. Regions are
+ * only evicted on a miss, so the cap must cover every buffer that can
+ * have an operation in flight at once.
+ * */
+class MrCache {
+ public:
+  struct Entry {
+    uintptr_t end_;                       /**< One past the last byte */
+    struct fid_mr *mr_;                   /**< The registration */
+    std::list<uintptr_t>::iterator lru_;  /**< Position in lru_ */
+  };
+  struct fid_domain *domain_ = nullptr;
+  uint64_t access_ = FI_SEND | FI_RECV | FI_READ | FI_WRITE;
+  size_t max_bytes_ = 0;         /**< Registered bytes to keep at most */
+  size_t bytes_ = 0;             /**< Registered bytes cached */
+  std::map<uintptr_t, Entry> entries_;  /**< Regions by start address */
+  std::list<uintptr_t> lru_;     /**< Region starts, most recent first */
+  size_t hits_ = 0, misses_ = 0, evictions_ = 0;
+
+ public:
+  MrCache() = default;
+
+  MrCache(struct fid_domain *domain, size_t max_bytes)
+      : domain_(domain), max_bytes_(max_bytes) {}
+
+  ~MrCache() {
+    Clear();
+  }
+
+  /** Find or create a registration covering [buf, buf + size) */
+  int Find(const void *buf, size_t size, struct fid_mr **mr) {
+    uintptr_t start = reinterpret_cast<uintptr_t>(buf);
+    uintptr_t end = start + size;
+
+    // Look for a region that starts at or before buf
+    auto it = entries_.upper_bound(start);
+    if (it != entries_.begin()) {
+      --it;
+      if (it->second.end_ >= end) {
+        hits_ += 1;
+        lru_.splice(lru_.begin(), lru_, it->second.lru_);
+        *mr = it->second.mr_;
+        return 0;
+      }
+      // A shorter region at the same start is superseded
+      if (it->first == start) {
+        Evict(it);
+      }
+    }
+
+    // Register the buffer
+    misses_ += 1;
+    int ret = fi_mr_reg(domain_, buf, size, access_, 0, 0, 0, mr, NULL);
+    if (ret) {
+      HELOG(kError, "Failed to register memory region: {}", fi_strerror(-ret));
+      return ret;
+    }
+    lru_.push_front(start);
+    entries_.emplace(start, Entry{end, *mr, lru_.begin()});
+    bytes_ += size;
+
+    // Evict least recently used regions, never the one just added
+    while (bytes_ > max_bytes_ && lru_.size() > 1) {
+      Evict(entries_.find(lru_.back()));
+    }
+    return 0;
+  }
+
+  /** Deregister everything */
+  void Clear() {
+    while (!entries_.empty()) {
+      Evict(entries_.begin());
+    }
+  }
+
+  /** Forget the hits, misses & evictions counted so far */
+  void ResetStats() {
+    hits_ = misses_ = evictions_ = 0;
+  }
+
+  /** Fraction of lookups which hit */
+  double HitRate() const {
+    size_t total = hits_ + misses_;
+    return total ? static_cast<double>(hits_) / total : 0;
+  }
+
+ private:
+  /** Deregister one region */
+  void Evict(std::map<uintptr_t, Entry>::iterator it) {
+    bytes_ -= it->second.end_ - it->first;
+    fi_close(&it->second.mr_->fid);
+    lru_.erase(it->second.lru_);
+    entries_.erase(it);
+    evictions_ += 1;
+  }
+};
+
+#endif  // FABRIC_INCLUDE_FABRIC_BENCH_MR_CACHE_H_
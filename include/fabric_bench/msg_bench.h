@@ -0,0 +1,433 @@
+//
+// Created by lukemartinlogan on 10/17/23.
+//
+
+#ifndef FABRIC_INCLUDE_FABRIC_BENCH_MSG_BENCH_H_
+#define FABRIC_INCLUDE_FABRIC_BENCH_MSG_BENCH_H_
+
+#include "socket_client.h"
+#include "rdma_server.h"
+#include "histogram.h"
+
+#include <cstring>
+
+/** Benchmarks the client can ask the server to run */
+enum class BenchMode : int {
+  kStop = 0,
+  kPingPong = 1,
+  kStream = 2,
+  kRegion = 3,
+  kHello = 4,
+  kCpu = 5,
+};
+
+/**
+ * Control message which starts a benchmark on the server.
+ * The server acks each command once it has pre-posted the receives
+ * the benchmark needs.
+ * */
+struct BenchCmd {
+  BenchMode mode_;   /**< Benchmark to run */
+  size_t msg_size_;  /**< Payload size */
+  size_t iters_;     /**< Number of messages, including warmup */
+  size_t window_;    /**< Maximum number of messages in flight */
+  CqPolicy policy_;  /**< How the server should wait on its CQ */
+  uint64_t spin_nsec_;  /**< Spin budget for CqPolicy::kHybrid */
+};
+
+/** Drives benchmarks from the client side of a connection */
+struct MsgBenchClient {
+  SocketClient *conn_;
+
+  explicit MsgBenchClient(SocketClient *conn) : conn_(conn) {}
+
+  /**
+   * Send a command and wait for the server to ack it. The server
+   * mirrors this client's CQ policy for the duration of the command.
+   * "extra" bytes already placed in TxBuf after the command are sent
+   * along with it.
+   * */
+  int Command(BenchCmd cmd, size_t extra = 0) {
+    int ret;
+    cmd.policy_ = conn_->progress_.policy_;
+    cmd.spin_nsec_ = conn_->progress_.spin_nsec_;
+    ret = conn_->PostRecv();
+    if (ret) {
+      return ret;
+    }
+    memcpy(conn_->TxBuf(), &cmd, sizeof(cmd));
+    ret = conn_->Send(sizeof(cmd) + extra);
+    if (ret) {
+      return ret;
+    }
+    return conn_->Recv();
+  }
+
+  /**
+   * Introduce this RDM endpoint to conn_->peer_. The server inserts the
+   * name we send into its AV, which is what lets it reply.
+   * */
+  int Hello() {
+    size_t name_len = conn_->max_msg_size_ - sizeof(BenchCmd);
+    int ret = fi_getname(&conn_->ep_->fid, conn_->TxBuf() + sizeof(BenchCmd),
+                         &name_len);
+    if (ret) {
+      HELOG(kError, "Failed to get the endpoint name: {}", fi_strerror(-ret));
+      return ret;
+    }
+    BenchCmd cmd = {BenchMode::kHello, name_len, 0, 0};
+    return Command(cmd, name_len);
+  }
+
+  /**
+   * Bounce "msg_size" messages off the server. Each sample is half
+   * of the measured round trip.
+   * */
+  int PingPong(size_t msg_size, size_t warmup, size_t iters,
+               LatencyHistogram &hist) {
+    int ret;
+    if (msg_size > conn_->max_msg_size_) {
+      HELOG(kError, "Message size {} exceeds buffer size {}",
+            msg_size, conn_->max_msg_size_);
+      return -FI_EINVAL;
+    }
+    BenchCmd cmd = {BenchMode::kPingPong, msg_size, warmup + iters, 1};
+    ret = Command(cmd);
+    if (ret) {
+      return ret;
+    }
+    hist.Reset();
+    for (size_t i = 0; i < cmd.iters_; ++i) {
+      ret = conn_->PostRecv();
+      if (ret) {
+        return ret;
+      }
+      uint64_t start = NowNsec();
+      ret = conn_->Send(msg_size);
+      if (ret) {
+        return ret;
+      }
+      ret = conn_->Recv();
+      if (ret) {
+        return ret;
+      }
+      uint64_t end = NowNsec();
+      if (i >= warmup) {
+        hist.Record((end - start) / 2);
+      }
+    }
+    return 0;
+  }
+
+  /**
+   * Stream "iters" messages to the server, keeping up to "window" sends
+   * in flight. The server acks once the last message has landed, so
+   * "nsec" covers delivery rather than just local completion.
+   * */
+  int Stream(size_t msg_size, size_t window, size_t iters, uint64_t &nsec) {
+    if (msg_size > conn_->max_msg_size_) {
+      HELOG(kError, "Message size {} exceeds buffer size {}",
+            msg_size, conn_->max_msg_size_);
+      return -FI_EINVAL;
+    }
+    return StreamWith(msg_size, window, iters, nsec, [&](size_t i) {
+      return conn_->PostSend(msg_size);
+    });
+  }
+
+  /**
+   * Stream as above, but "post(i)" posts the i'th send. Used to stream
+   * from buffers other than TxBuf.
+   * */
+  template<typename PostT>
+  int StreamWith(size_t msg_size, size_t window, size_t iters,
+                 uint64_t &nsec, PostT &&post) {
+    int ret;
+    window = std::max<size_t>(window, 1);
+    BenchCmd cmd = {BenchMode::kStream, msg_size, iters, window};
+    ret = Command(cmd);
+    if (ret) {
+      return ret;
+    }
+    ret = conn_->PostRecv();
+    if (ret) {
+      return ret;
+    }
+    uint64_t start = NowNsec();
+    for (size_t i = 0; i < iters; ++i) {
+      ret = conn_->WaitTx(window - 1);
+      if (ret) {
+        return ret;
+      }
+      ret = post(i);
+      if (ret) {
+        return ret;
+      }
+    }
+    ret = conn_->WaitTx();
+    if (ret) {
+      return ret;
+    }
+    ret = conn_->Recv();
+    if (ret) {
+      return ret;
+    }
+    nsec = NowNsec() - start;
+    return 0;
+  }
+
+  /** Ask the server which region RMA operations may target */
+  int Region(RmaRegion &region) {
+    BenchCmd cmd = {BenchMode::kRegion, 0, 0, 0};
+    int ret = Command(cmd);
+    if (ret) {
+      return ret;
+    }
+    if (conn_->rx_len_ != sizeof(region)) {
+      HELOG(kError, "The server does not expose an RMA region");
+      return -FI_ENODATA;
+    }
+    memcpy(&region, conn_->rx_data_, sizeof(region));
+    return 0;
+  }
+
+  /** Ask the server how much CPU time its process has used */
+  int ServerCpu(uint64_t &nsec) {
+    BenchCmd cmd = {BenchMode::kCpu, 0, 0, 0};
+    int ret = Command(cmd);
+    if (ret) {
+      return ret;
+    }
+    if (conn_->rx_len_ != sizeof(nsec)) {
+      HELOG(kError, "The server did not report its CPU time");
+      return -FI_ENODATA;
+    }
+    memcpy(&nsec, conn_->rx_data_, sizeof(nsec));
+    return 0;
+  }
+
+  /** Tell the server this client is done */
+  int Stop() {
+    BenchCmd cmd = {BenchMode::kStop, 0, 0, 0};
+    return Command(cmd);
+  }
+};
+
+/**
+ * Executes benchmark commands on the server side of a connection.
+ * Nothing here blocks except Serve, so a single progress thread can
+ * multiplex many connections by calling Poll on each.
+ * */
+struct MsgBenchServer {
+  SocketClient *conn_;
+  const RmaRegion *region_ = nullptr;  /**< Region exposed for RMA */
+  BenchCmd cmd_;            /**< Command being executed */
+  size_t remaining_ = 0;    /**< Messages left to receive for cmd_ */
+  size_t posted_ = 0;       /**< Receives posted for cmd_ */
+  bool running_ = false;    /**< Whether cmd_ is in progress */
+  bool done_ = false;       /**< Whether the client has stopped */
+  size_t rx_bytes_ = 0;     /**< Payload bytes received */
+  uint64_t first_nsec_ = 0; /**< When the first command arrived */
+  uint64_t last_nsec_ = 0;  /**< When the last command finished */
+
+  explicit MsgBenchServer(SocketClient *conn) : conn_(conn) {}
+
+  /**
+   * Execute commands until the client stops. Expects one receive to
+   * already be posted for the first command.
+   * */
+  int Serve() {
+    while (!done_) {
+      int ret = Poll(true);
+      if (ret) {
+        return ret;
+      }
+    }
+    return 0;
+  }
+
+  /**
+   * Handle every receive that has completed. If "block", wait for one
+   * according to the connection's CQ policy when none are ready.
+   * */
+  int Poll(bool block) {
+    int ret;
+    if (conn_->rx_done_ == conn_->rx_consumed_) {
+      ssize_t rc = conn_->ReapCompletions(block);
+      if (rc < 0) {
+        return (int) rc;
+      }
+    }
+    while (!done_ && conn_->rx_done_ > conn_->rx_consumed_) {
+      conn_->rx_consumed_ += 1;
+      ret = running_ ? OnMessage() : OnCommand();
+      if (ret) {
+        return ret;
+      }
+    }
+    return 0;
+  }
+
+  /** Let the client know the command can start */
+  int Ack() {
+    int status = 0;
+    memcpy(conn_->TxBuf(), &status, sizeof(status));
+    return conn_->PostSend(sizeof(status));
+  }
+
+ private:
+  /** Start executing a newly received command */
+  int OnCommand() {
+    int ret;
+    if (conn_->rx_len_ < sizeof(BenchCmd)) {
+      HELOG(kError, "Expected a command, got {} bytes", conn_->rx_len_);
+      return -FI_EINVAL;
+    }
+    memcpy(&cmd_, conn_->rx_data_, sizeof(cmd_));
+    if (cmd_.mode_ != BenchMode::kHello &&
+        conn_->rx_len_ != sizeof(BenchCmd)) {
+      HELOG(kError, "Expected a command, got {} bytes", conn_->rx_len_);
+      return -FI_EINVAL;
+    }
+    conn_->progress_.policy_ = cmd_.policy_;
+    conn_->progress_.spin_nsec_ = cmd_.spin_nsec_;
+    if (first_nsec_ == 0) {
+      first_nsec_ = NowNsec();
+    }
+    remaining_ = cmd_.iters_;
+    switch (cmd_.mode_) {
+      case BenchMode::kPingPong: {
+        // The receive for the next message is always posted before
+        // replying, so the last one posted catches the next command.
+        ret = conn_->PostRecv();
+        if (ret) {
+          return ret;
+        }
+        running_ = remaining_ > 0;
+        return Ack();
+      }
+      case BenchMode::kStream: {
+        // Keep "window" receives posted & ack once everything arrived
+        posted_ = std::min(cmd_.window_, cmd_.iters_);
+        for (size_t i = 0; i < posted_; ++i) {
+          ret = conn_->PostRecv();
+          if (ret) {
+            return ret;
+          }
+        }
+        running_ = true;
+        ret = Ack();
+        if (ret) {
+          return ret;
+        }
+        return remaining_ ? 0 : FinishStream();
+      }
+      case BenchMode::kRegion: {
+        // Reply with the region in place of the ack
+        ret = conn_->PostRecv();
+        if (ret) {
+          return ret;
+        }
+        if (!region_) {
+          return Ack();
+        }
+        memcpy(conn_->TxBuf(), region_, sizeof(RmaRegion));
+        return conn_->PostSend(sizeof(RmaRegion));
+      }
+      case BenchMode::kCpu: {
+        // Reply with the process CPU time in place of the ack
+        ret = conn_->PostRecv();
+        if (ret) {
+          return ret;
+        }
+        uint64_t cpu_nsec = ProcessCpuNsec();
+        memcpy(conn_->TxBuf(), &cpu_nsec, sizeof(cpu_nsec));
+        return conn_->PostSend(sizeof(cpu_nsec));
+      }
+      case BenchMode::kHello: {
+        // A truncated name can't be inserted, and without it there is
+        // nobody to ack. Drop it and wait for the next hello.
+        if (cmd_.msg_size_ == 0 ||
+            conn_->rx_len_ < sizeof(BenchCmd) + cmd_.msg_size_) {
+          HELOG(kError, "Hello of {} bytes is too short for a {} byte name",
+                conn_->rx_len_, cmd_.msg_size_);
+          return conn_->PostRecv();
+        }
+        // Insert the client's name so the ack can reach it
+        ret = conn_->InsertPeer(conn_->rx_data_ + sizeof(BenchCmd),
+                                conn_->peer_);
+        if (ret) {
+          return ret;
+        }
+        ret = conn_->PostRecv();
+        if (ret) {
+          return ret;
+        }
+        return Ack();
+      }
+      case BenchMode::kStop: {
+        done_ = true;
+        last_nsec_ = NowNsec();
+        // An RDM endpoint outlives its clients: catch the next hello
+        if (conn_->ep_type_ == FI_EP_RDM) {
+          ret = conn_->PostRecv();
+          if (ret) {
+            return ret;
+          }
+        }
+        ret = Ack();
+        if (ret) {
+          return ret;
+        }
+        return conn_->WaitTx();
+      }
+      default: {
+        HELOG(kError, "Unknown benchmark mode: {}", (int)cmd_.mode_);
+        return -FI_EINVAL;
+      }
+    }
+  }
+
+  /** Handle one payload message of the running command */
+  int OnMessage() {
+    int ret;
+    rx_bytes_ += cmd_.msg_size_;
+    remaining_ -= 1;
+    switch (cmd_.mode_) {
+      case BenchMode::kPingPong: {
+        ret = conn_->PostRecv();
+        if (ret) {
+          return ret;
+        }
+        running_ = remaining_ > 0;
+        return conn_->PostSend(cmd_.msg_size_);
+      }
+      case BenchMode::kStream: {
+        if (posted_ < cmd_.iters_) {
+          ret = conn_->PostRecv();
+          if (ret) {
+            return ret;
+          }
+          ++posted_;
+        }
+        return remaining_ ? 0 : FinishStream();
+      }
+      default: {
+        return -FI_EINVAL;
+      }
+    }
+  }
+
+  /** Catch the next command, then ack the end of the stream */
+  int FinishStream() {
+    int ret = conn_->PostRecv();
+    if (ret) {
+      return ret;
+    }
+    running_ = false;
+    last_nsec_ = NowNsec();
+    return Ack();
+  }
+};
+
+#endif  // FABRIC_INCLUDE_FABRIC_BENCH_MSG_BENCH_H_
@@ -0,0 +1,162 @@
+//
+// Created by lukemartinlogan on 10/17/23.
+//
+
+#ifndef FABRIC_INCLUDE_FABRIC_BENCH_OMP_BENCH_H_
+#define FABRIC_INCLUDE_FABRIC_BENCH_OMP_BENCH_H_
+
+#include "socket_client.h"
+#include "msg_bench.h"
+#include "shard_bench.h"
+
+#include <atomic>
+#include <omp.h>
+
+/** How the threads of an OpenMP region reach the server */
+enum class OmpEpMode : int {
+  kShared = 0,     /**< One FI_THREAD_SAFE endpoint for every thread */
+  kPerThread = 1,  /**< One endpoint per thread */
+};
+
+/**
+ * Sends issued from inside an OpenMP parallel region, as compute code
+ * does. The shared mode funnels every thread through one endpoint; the
+ * per-thread mode gives each thread its own ShardedClient shard.
+ * */
+struct OmpMsgRate {
+  SocketClient *shared_;  /**< The FI_THREAD_SAFE connection */
+  ShardedClient *shards_; /**< One connection per thread */
+
+  OmpMsgRate(SocketClient *shared, ShardedClient *shards)
+      : shared_(shared), shards_(shards) {}
+
+  /**
+   * Each of "num_threads" threads sends "iters" messages; "rate" is the
+   * total messages per second. In shared mode, "wait_frac" is the
+   * fraction of thread time spent waiting for the endpoint.
+   * */
+  int Run(OmpEpMode mode, int num_threads, size_t msg_size, size_t window,
+          size_t iters, double &rate, double &wait_frac) {
+    wait_frac = 0;
+    if (mode == OmpEpMode::kShared) {
+      return RunShared(num_threads, msg_size, window, iters, rate, wait_frac);
+    }
+    return RunPerThread(num_threads, msg_size, window, iters, rate);
+  }
+
+ private:
+  /**
+   * One stream command covers every thread's messages. Every thread
+   * calls fi_send on the endpoint concurrently, so the provider's own
+   * FI_THREAD_SAFE locking is what is measured. The window is shared:
+   * a thread takes a slot before posting, and only the master thread
+   * reads the CQ, handing slots back as sends complete. Time spent
+   * waiting for a slot or for the endpoint to accept a send
+   * (-FI_EAGAIN) is the cost of sharing.
+   * */
+  int RunShared(int num_threads, size_t msg_size, size_t window,
+                size_t iters, double &rate, double &wait_frac) {
+    MsgBenchClient bench(shared_);
+    window = std::max<size_t>(window, 1);
+    size_t total = num_threads * iters;
+    BenchCmd cmd = {BenchMode::kStream, msg_size, total, window};
+    int ret = bench.Command(cmd);
+    if (ret == 0) {
+      ret = shared_->PostRecv();
+    }
+    if (ret) {
+      return ret;
+    }
+    std::atomic<size_t> inflight(0), posted(0), done(0);
+    std::atomic<int> error(0);
+    // Reap sends on the master thread only; tx_done_ is not atomic
+    auto reap = [&]() {
+      size_t before = shared_->tx_done_;
+      ssize_t rc = shared_->ReapCompletions();
+      if (rc < 0) {
+        error = (int) rc;
+      }
+      size_t reaped = shared_->tx_done_ - before;
+      done += reaped;
+      inflight -= reaped;
+    };
+    char *buf = shared_->TxBuf();
+    void *desc = fi_mr_desc(shared_->mr_);
+    uint64_t wait_nsec = 0;
+    uint64_t start = NowNsec();
+#pragma omp parallel num_threads(num_threads) reduction(+:wait_nsec)
+    {
+      bool master = omp_get_thread_num() == 0;
+      for (size_t i = 0; i < iters && error == 0; ++i) {
+        uint64_t wait_start = NowNsec();
+        size_t cur = inflight.load();
+        while (error == 0 &&
+               (cur >= window ||
+                !inflight.compare_exchange_weak(cur, cur + 1))) {
+          if (master) {
+            reap();
+          }
+          cur = inflight.load();
+        }
+        ssize_t rc = -FI_EAGAIN;
+        while (error == 0 && rc == -FI_EAGAIN) {
+          rc = fi_send(shared_->ep_, buf, msg_size, desc, shared_->peer_,
+                       NULL);
+          if (rc == -FI_EAGAIN && master) {
+            reap();
+          }
+        }
+        wait_nsec += NowNsec() - wait_start;
+        if (rc == 0) {
+          posted += 1;
+        } else if (rc != -FI_EAGAIN) {
+          HELOG(kError, "fi_send failed: {}", fi_strerror(-rc));
+          error = (int) rc;
+        }
+      }
+      if (master) {
+        while (error == 0 && done < total) {
+          reap();
+        }
+      }
+    }
+    shared_->tx_posted_ += posted;
+    ret = error;
+    if (ret == 0) {
+      ret = shared_->Recv();
+    }
+    if (ret) {
+      return ret;
+    }
+    uint64_t nsec = std::max<uint64_t>(NowNsec() - start, 1);
+    rate = 1e9 * total / nsec;
+    wait_frac = (double)wait_nsec / ((double)num_threads * nsec);
+    return 0;
+  }
+
+  /** Each thread streams on its own shard, starting together */
+  int RunPerThread(int num_threads, size_t msg_size, size_t window,
+                   size_t iters, double &rate) {
+    num_threads = std::min<int>(num_threads, (int)shards_->shards_.size());
+    std::vector<uint64_t> nsecs(num_threads, 0);
+    std::vector<int> rets(num_threads, 0);
+#pragma omp parallel num_threads(num_threads)
+    {
+      int tid = omp_get_thread_num();
+      MsgBenchClient bench(shards_->shards_[tid].get());
+#pragma omp barrier
+      rets[tid] = bench.Stream(msg_size, window, iters, nsecs[tid]);
+    }
+    uint64_t nsec = 1;
+    for (int i = 0; i < num_threads; ++i) {
+      if (rets[i]) {
+        return rets[i];
+      }
+      nsec = std::max(nsec, nsecs[i]);
+    }
+    rate = 1e9 * num_threads * iters / nsec;
+    return 0;
+  }
+};
+
+#endif  // FABRIC_INCLUDE_FABRIC_BENCH_OMP_BENCH_H_
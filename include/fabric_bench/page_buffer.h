@@ -0,0 +1,167 @@
+//
+// Created by lukemartinlogan on 10/17/23.
+//
+
+#ifndef FABRIC_INCLUDE_FABRIC_BENCH_PAGE_BUFFER_H_
+#define FABRIC_INCLUDE_FABRIC_BENCH_PAGE_BUFFER_H_
+
+#include "hermes_shm/util/logging.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+#include <sys/mman.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+/** Which pages back a payload buffer */
+enum class PageKind : int {
+  kSmall = 0,   /**< Regular 4 KB pages */
+  kHuge2M = 1,  /**< 2 MB hugepages */
+  kHuge1G = 2,  /**< 1 GB hugepages */
+};
+
+/**
+ * A payload buffer mapped directly with mmap, optionally from
+ * hugepages. If the requested hugepages are not available, it falls
+ * back to regular pages. Benchmarks register it once, so fewer and
+ * larger pages mean fewer TLB misses and fewer pages to pin.
+ * */
+class PageBuffer {
+ public:
+  char *data_ = nullptr;  /**< Start of the mapping */
+  size_t size_ = 0;       /**< Bytes requested */
+  size_t mapped_ = 0;     /**< Bytes mapped (rounded to the page size) */
+  PageKind kind_ = PageKind::kSmall;  /**< Pages actually used */
+
+ public:
+  PageBuffer() = default;
+  PageBuffer(const PageBuffer &) = delete;
+  PageBuffer& operator=(const PageBuffer &) = delete;
+
+  PageBuffer(PageBuffer &&other) noexcept {
+    *this = std::move(other);
+  }
+
+  PageBuffer& operator=(PageBuffer &&other) noexcept {
+    if (this != &other) {
+      Free();
+      std::swap(data_, other.data_);
+      std::swap(size_, other.size_);
+      std::swap(mapped_, other.mapped_);
+      std::swap(kind_, other.kind_);
+    }
+    return *this;
+  }
+
+  ~PageBuffer() {
+    Free();
+  }
+
+  /** Parse "4k", "2m", or "1g" */
+  static PageKind ParseKind(const std::string &name) {
+    if (name == "4k" || name.empty()) {
+      return PageKind::kSmall;
+    } else if (name == "2m") {
+      return PageKind::kHuge2M;
+    } else if (name == "1g") {
+      return PageKind::kHuge1G;
+    }
+    HELOG(kFatal, "Unknown page size: {}", name);
+    return PageKind::kSmall;
+  }
+
+  /** Name of a page kind */
+  static const char* KindName(PageKind kind) {
+    switch (kind) {
+      case PageKind::kSmall: return "4k";
+      case PageKind::kHuge2M: return "2m";
+      case PageKind::kHuge1G: return "1g";
+    }
+    return "unknown";
+  }
+
+  /**
+   * Replace the buffer with "size" bytes backed by "kind" pages. The
+   * previous contents are discarded.
+   * */
+  bool Allocate(size_t size, PageKind kind) {
+    Free();
+    size_ = size;
+    if (kind != PageKind::kSmall && Map(size, kind)) {
+      return true;
+    }
+    if (kind != PageKind::kSmall) {
+      HILOG(kWarning, "No {} hugepages for {} bytes, using 4k pages",
+            KindName(kind), size);
+    }
+    if (Map(size, PageKind::kSmall)) {
+      return true;
+    }
+    HELOG(kError, "Failed to map {} bytes", size);
+    size_ = 0;
+    return false;
+  }
+
+  /** Unmap the buffer */
+  void Free() {
+    if (data_) {
+      munmap(data_, mapped_);
+      data_ = nullptr;
+      size_ = 0;
+      mapped_ = 0;
+    }
+  }
+
+  char* data() {
+    return data_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+ private:
+  /** mmap "size" bytes from "kind" pages */
+  bool Map(size_t size, PageKind kind) {
+    size_t page_size;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    switch (kind) {
+      case PageKind::kHuge2M: {
+        page_size = 1ull << 21;
+        flags |= MAP_HUGETLB | MAP_HUGE_2MB;
+        break;
+      }
+      case PageKind::kHuge1G: {
+        page_size = 1ull << 30;
+        flags |= MAP_HUGETLB | MAP_HUGE_1GB;
+        break;
+      }
+      default: {
+        page_size = 4096;
+        break;
+      }
+    }
+    size_t mapped = (std::max<size_t>(size, 1) + page_size - 1) /
+        page_size * page_size;
+    void *addr = mmap(NULL, mapped, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (addr == MAP_FAILED) {
+      return false;
+    }
+    data_ = reinterpret_cast<char*>(addr);
+    mapped_ = mapped;
+    kind_ = kind;
+    return true;
+  }
+};
+
+#endif  // FABRIC_INCLUDE_FABRIC_BENCH_PAGE_BUFFER_H_
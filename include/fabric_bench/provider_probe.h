@@ -0,0 +1,386 @@
+//
+// Created by lukemartinlogan on 10/17/23.
+//
+
+#ifndef FABRIC_INCLUDE_FABRIC_BENCH_PROVIDER_PROBE_H_
+#define FABRIC_INCLUDE_FABRIC_BENCH_PROVIDER_PROBE_H_
+
+#include "config_manager.h"
+#include "socket_client.h"
+#include "socket_server.h"
+#include "msg_bench.h"
+#include "histogram.h"
+
+#include <fstream>
+#include <sstream>
+
+/** A provider & endpoint type fi_getinfo can open for messaging */
+struct ProbeTarget {
+  std::string provider_;
+  std::string ep_type_;  /**< "msg" or "rdm" */
+};
+
+/** One provider's probe at one message size */
+struct ProbeResult {
+  std::string provider_;
+  std::string ep_type_;
+  size_t size_;
+  double p50_us_;  /**< Ping-pong latency */
+  double gbps_;    /**< Streamed bandwidth */
+};
+
+/**
+ * Discovers the providers of this host and measures each with a short
+ * loopback ping-pong & stream: a server and a client in this process,
+ * over the provider's own stack. Only providers which can reach other
+ * hosts are probed, since loopback would flatter local-only ones
+ * (e.g., shm) which fabric_client could never use against a remote
+ * server.
+ * */
+struct ProviderProbe {
+  /**
+   * Every provider fi_getinfo returns for FI_MSG with FI_REMOTE_COMM,
+   * once per endpoint type. Layered providers keep their full name
+   * (e.g., "tcp;ofi_rxm").
+   * */
+  static std::vector<ProbeTarget> Discover() {
+    std::vector<ProbeTarget> targets;
+    for (const char *ep_type : {"msg", "rdm"}) {
+      struct fi_info *hints = fi_allocinfo();
+      hints->caps = FI_MSG | FI_REMOTE_COMM;
+      hints->ep_attr->type = SocketClient::ParseEpType(ep_type);
+      hints->domain_attr->mr_mode = FI_MR_BASIC;
+      struct fi_info *info = nullptr;
+      int ret = fi_getinfo(FI_VERSION(1, 14), NULL, NULL, 0, hints, &info);
+      fi_freeinfo(hints);
+      if (ret) {
+        // No provider offers this endpoint type
+        continue;
+      }
+      for (struct fi_info *cur = info; cur; cur = cur->next) {
+        if (!(cur->caps & FI_REMOTE_COMM)) {
+          continue;
+        }
+        std::string provider = cur->fabric_attr->prov_name;
+        bool found = false;
+        for (ProbeTarget &target : targets) {
+          found |= target.provider_ == provider && target.ep_type_ == ep_type;
+        }
+        if (!found) {
+          targets.push_back({provider, ep_type});
+        }
+      }
+      fi_freeinfo(info);
+    }
+    return targets;
+  }
+
+  /**
+   * Probe "target" at each of the config's size classes, serving it on
+   * "port". Appends one result per size to "results", only once every
+   * size has been probed, so a provider which fails part way through is
+   * not ranked on the sizes it managed.
+   * */
+  static int Probe(const ProbeTarget &target, int port,
+                   ConfigManager &config, std::vector<ProbeResult> &results) {
+    std::vector<size_t> sizes = config.GetProbeSizes();
+    if (sizes.empty()) {
+      return 0;
+    }
+    size_t max_size = *std::max_element(sizes.begin(), sizes.end());
+    SocketServer server;
+    server.num_workers_ = 1;
+    server.num_clients_ = 1;
+    server.poll_all_ = true;
+    server.ep_type_ = SocketClient::ParseEpType(target.ep_type_);
+    int ret = server.ServerInit(target.provider_, port, config.my_ip_,
+                               max_size);
+    if (ret) {
+      return ret;
+    }
+
+    SocketClient client;
+    ret = Connect(client, target, port, config.my_ip_, max_size);
+    MsgBenchClient bench(&client);
+    size_t iters = std::max<size_t>(config.probe_iterations_, 1);
+    size_t warmup = std::max<size_t>(iters / 10, 1);
+    size_t window = config.windows_.back();
+    std::vector<ProbeResult> probed;
+    for (size_t i = 0; i < sizes.size() && ret == 0; ++i) {
+      LatencyHistogram hist;
+      uint64_t nsec = 1;
+      ret = bench.PingPong(sizes[i], warmup, iters, hist);
+      if (ret == 0) {
+        ret = bench.Stream(sizes[i], window, warmup, nsec);
+      }
+      if (ret == 0) {
+        ret = bench.Stream(sizes[i], window, iters, nsec);
+      }
+      if (ret == 0) {
+        probed.push_back({target.provider_, target.ep_type_, sizes[i],
+                          hist.Percentile(50) / 1000.0,
+                          static_cast<double>(sizes[i]) * iters /
+                              std::max<uint64_t>(nsec, 1)});
+      }
+    }
+    if (ret == 0) {
+      ret = bench.Stop();
+    }
+    StopServer(server);
+    if (ret == 0) {
+      results.insert(results.end(), probed.begin(), probed.end());
+    }
+    return ret;
+  }
+
+  /**
+   * Connect "client" to a server of "target" on "ip":"port", with
+   * buffers for "max_size" messages. RDM clients also say hello, so the
+   * server learns their address.
+   * */
+  static int Connect(SocketClient &client, const ProbeTarget &target,
+                     int port, const std::string &ip, size_t max_size) {
+    client.ep_type_ = SocketClient::ParseEpType(target.ep_type_);
+    int ret = client.ClientInit(target.provider_, port, ip);
+    if (ret == 0) {
+      ret = client.RegisterBuffers(max_size);
+    }
+    if (ret == 0 && client.ep_type_ == FI_EP_RDM) {
+      ret = client.InsertPeers({ip});
+      if (ret == 0) {
+        client.peer_ = client.peers_[0];
+        ret = MsgBenchClient(&client).Hello();
+      }
+    }
+    return ret;
+  }
+
+ private:
+  /** Stop "server" even if its client never connected */
+  static void StopServer(SocketServer &server) {
+    server.stop_ = true;
+    if (server.accept_thread_) {
+      server.accept_thread_->join();
+    }
+    for (auto &worker : server.workers_) {
+      worker->thread_.join();
+    }
+  }
+};
+
+/** A provider & endpoint type, and the size classes sent over it */
+struct ProviderRoute {
+  ProbeTarget target_;
+  std::vector<size_t> size_classes_;
+};
+
+/**
+ * The probe results as a ranking per size class. Small messages are
+ * ranked by latency and bulk ones by bandwidth, which is what decides
+ * their cost. The table is saved as CSV so the choice made on one run
+ * of provider_probe is reused by later runs.
+ * */
+struct ProviderTable {
+  static const size_t kBulkSize = KILOBYTES(64);  /**< Rank by GB/s from */
+  std::vector<ProbeResult> results_;
+
+  /** Size class of "size": the smallest probed size that holds it */
+  size_t SizeClass(size_t size) const {
+    size_t best = 0, largest = 0;
+    for (const ProbeResult &result : results_) {
+      largest = std::max(largest, result.size_);
+      if (result.size_ >= size && (best == 0 || result.size_ < best)) {
+        best = result.size_;
+      }
+    }
+    return best ? best : largest;
+  }
+
+  /** Results of one size class, fastest first */
+  std::vector<ProbeResult> Rank(size_t size_class) const {
+    std::vector<ProbeResult> ranked;
+    for (const ProbeResult &result : results_) {
+      if (result.size_ == size_class) {
+        ranked.push_back(result);
+      }
+    }
+    bool by_bw = size_class >= kBulkSize;
+    std::stable_sort(ranked.begin(), ranked.end(),
+                     [by_bw](const ProbeResult &a, const ProbeResult &b) {
+      return by_bw ? a.gbps_ > b.gbps_ : a.p50_us_ < b.p50_us_;
+    });
+    return ranked;
+  }
+
+  /** The fastest provider for messages of "size" bytes (false if none) */
+  bool Select(size_t size, ProbeResult &best) const {
+    std::vector<ProbeResult> ranked = Rank(SizeClass(size));
+    if (ranked.empty()) {
+      return false;
+    }
+    best = ranked[0];
+    return true;
+  }
+
+  /** Distinct size classes, smallest first */
+  std::vector<size_t> SizeClasses() const {
+    std::vector<size_t> sizes;
+    for (const ProbeResult &result : results_) {
+      if (std::find(sizes.begin(), sizes.end(), result.size_) ==
+          sizes.end()) {
+        sizes.push_back(result.size_);
+      }
+    }
+    std::sort(sizes.begin(), sizes.end());
+    return sizes;
+  }
+
+  /**
+   * The fastest provider of every size class, smallest class first, with
+   * classes sharing a provider & ep grouped into one route
+   * */
+  std::vector<ProviderRoute> Routes() const {
+    std::vector<ProviderRoute> routes;
+    for (size_t size_class : SizeClasses()) {
+      ProbeResult best;
+      if (!Select(size_class, best)) {
+        continue;
+      }
+      auto route = std::find_if(routes.begin(), routes.end(),
+                                [&](const ProviderRoute &route) {
+        return route.target_.provider_ == best.provider_ &&
+            route.target_.ep_type_ == best.ep_type_;
+      });
+      if (route == routes.end()) {
+        routes.push_back({{best.provider_, best.ep_type_}, {}});
+        route = routes.end() - 1;
+      }
+      route->size_classes_.push_back(size_class);
+    }
+    return routes;
+  }
+
+  /** Print the ranking of every size class */
+  void Print() const {
+    printf("# provider ranking (latency below %zu B, bandwidth from)\n",
+           kBulkSize);
+    printf("%12s %6s %20s %6s %10s %10s\n", "size(B)", "rank", "provider",
+           "ep", "p50(us)", "GB/s");
+    for (size_t size_class : SizeClasses()) {
+      std::vector<ProbeResult> ranked = Rank(size_class);
+      for (size_t i = 0; i < ranked.size(); ++i) {
+        printf("%12zu %6zu %20s %6s %10.2f %10.3f\n", size_class, i + 1,
+               ranked[i].provider_.c_str(), ranked[i].ep_type_.c_str(),
+               ranked[i].p50_us_, ranked[i].gbps_);
+      }
+    }
+  }
+
+  /** Write the results as CSV */
+  bool Save(const std::string &path) const {
+    std::ofstream out(path);
+    if (!out) {
+      HELOG(kError, "Could not open provider table {}", path);
+      return false;
+    }
+    out << "provider,ep_type,size,p50_us,gbps\n";
+    for (const ProbeResult &result : results_) {
+      out << result.provider_ << "," << result.ep_type_ << ","
+          << result.size_ << "," << result.p50_us_ << ","
+          << result.gbps_ << "\n";
+    }
+    return true;
+  }
+
+  /** Read results written by Save */
+  bool Load(const std::string &path) {
+    std::ifstream in(path);
+    if (!in) {
+      HELOG(kError, "Could not open provider table {}", path);
+      return false;
+    }
+    std::string line;
+    std::getline(in, line);
+    results_.clear();
+    while (std::getline(in, line)) {
+      std::istringstream fields(line);
+      ProbeResult result;
+      std::string size, p50, gbps;
+      if (!std::getline(fields, result.provider_, ',') ||
+          !std::getline(fields, result.ep_type_, ',') ||
+          !std::getline(fields, size, ',') ||
+          !std::getline(fields, p50, ',') ||
+          !std::getline(fields, gbps, ',')) {
+        continue;
+      }
+      result.size_ = std::stoull(size);
+      result.p50_us_ = std::stod(p50);
+      result.gbps_ = std::stod(gbps);
+      results_.push_back(result);
+    }
+    return true;
+  }
+};
+
+/**
+ * With protocol "auto", replace the config's provider & ep_type with the
+ * fastest for auto_msg_size in the provider table. The client & server
+ * each call this, so they must be given the same table (one probe run,
+ * copied or on a shared file system) to pick the same provider.
+ * */
+static inline bool ResolveProvider(ConfigManager &config) {
+  if (config.protocol_ != "auto") {
+    return true;
+  }
+  ProviderTable table;
+  ProbeResult best;
+  if (!table.Load(config.provider_table_) ||
+      !table.Select(config.auto_msg_size_, best)) {
+    HELOG(kError, "No provider to pick: run provider_probe first");
+    return false;
+  }
+  config.protocol_ = best.provider_;
+  config.ep_type_ = best.ep_type_;
+  HILOG(kInfo, "Picked {} ({}) for {} B messages", best.provider_,
+        best.ep_type_, config.auto_msg_size_);
+  return true;
+}
+
+/**
+ * With protocol "auto", each message size goes over the fastest
+ * provider of its size class. Each route gets its own connection, on
+ * the config's route ports. The client & server load the same table,
+ * so they agree on the routes and their order.
+ * */
+struct ProviderRouter {
+  ProviderTable table_;
+  std::vector<ProviderRoute> routes_;
+
+  /** Load the routes of the config's provider table */
+  bool Load(ConfigManager &config) {
+    if (!table_.Load(config.provider_table_)) {
+      return false;
+    }
+    routes_ = table_.Routes();
+    if (routes_.empty()) {
+      HELOG(kError, "No provider to route over: run provider_probe first");
+      return false;
+    }
+    return true;
+  }
+
+  /** Index of the route for messages of "size" bytes */
+  size_t Find(size_t size) const {
+    size_t size_class = table_.SizeClass(size);
+    for (size_t i = 0; i < routes_.size(); ++i) {
+      const std::vector<size_t> &classes = routes_[i].size_classes_;
+      if (std::find(classes.begin(), classes.end(), size_class) !=
+          classes.end()) {
+        return i;
+      }
+    }
+    return 0;
+  }
+};
+
+#endif  // FABRIC_INCLUDE_FABRIC_BENCH_PROVIDER_PROBE_H_
@@ -2,294 +2,165 @@
 // Created by lukemartinlogan on 8/9/23.
 //
 
-#ifndef LIBFABRIC_BENCH_SRC_TCP_CLIENT_H_
-#define LIBFABRIC_BENCH_SRC_TCP_CLIENT_H_
+#ifndef LIBFABRIC_BENCH_SRC_RDMA_CLIENT_H_
+#define LIBFABRIC_BENCH_SRC_RDMA_CLIENT_H_
 
-struct RdmaClient {
-  std::vector<char> data_;
-  struct fi_info* fi_;          /**< General fabric info */
-  struct fi_info *hints_;       /**< Properties for creating info */
-  struct fid_fabric* fabric_;   /**< Fabric ID */
-  struct fid_domain* domain_;   /**< Fabric domain */
-  struct fid_av *av_;           /**< Address vector */
-  struct fid_pep *pep_;         /**< Passive endpoint */
-  struct fid_ep* ep_;           /**< Active endpoint */
-  struct fid_eq *eq_;           /**< Emission queue (RDMA) */
-  struct fid_cntr *cntr_;        /**< Completion counter */
-  struct fid_mr* mr_;           /**< Memory region (RDMA) */
-  std::list<std::unique_ptr<ConnectionInfo>> clients_;
-
-  char* copy_string(const std::string &str) {
-    char* ret = new char[str.size() + 1];
-    std::copy(str.begin(), str.end(), ret);
-    ret[str.size()] = '\0';
-    return ret;
-  }
-
-  int CommonInit(const std::string &provider, int port, const std::string &ip_addr) {
-    int ret;
-
-    // Allocate fabric info
-    ProviderInfo prov_info(provider);
-    hints_ = fi_allocinfo();
-    hints_->fabric_attr->prov_name = copy_string(provider);
-    std::string port_str = std::to_string(port);
-    ret = fi_getinfo(FI_VERSION(1, 14),
-                     ip_addr.c_str(), port_str.c_str(),
-                     0, hints_, &fi_);
-    if (ret) {
-      HELOG(kError, "Failed to get fabric info");
-      return ret;
-    }
-
-    // Open a fabric domain & initialize endpoint
-    ret = fi_fabric(fi_->fabric_attr, &fabric_, NULL);
-    if (ret) {
-      HELOG(kError, "Failed to initialize fabric");
-      return ret;
-    }
-    ret = fi_domain(fabric_, fi_, &domain_, NULL);
-    if (ret) {
-      HELOG(kError, "Failed to initialize domain");
-      return ret;
-    }
+#include "socket_client.h"
+#include "rdma_server.h"
+#include "msg_bench.h"
 
-    // Create emission queue
-    struct fi_eq_attr eq_attr = {
-        .size = 0,
-        .flags = 0,
-        .wait_obj = FI_WAIT_UNSPEC,
-        .signaling_vector = 0,
-        .wait_set = NULL,
-    };
-    ret = fi_eq_open(fabric_, &eq_attr, &eq_, NULL);
-    if (ret) {
-      perror("fi_eq_open");
-      return ret;
-    }
+#include <rdma/fi_rma.h>
 
-    // Open completion counter
-    /*
-    struct fi_cntr_attr cntr_attr;
-    memset(&cntr_attr, 0, sizeof(cntr_attr));
-    ret = fi_cntr_open(domain_, &cntr_attr, &cntr_, NULL);
-    if (ret) {
-      HELOG(kError, "Failed to open completion queue")
-      return ret;
-    }*/
-    return ret;
-  }
+/**
+ * The initiator side of the RMA benchmarks. Issues fi_write / fi_read
+ * against the server's RdmaServer region over an existing connection
+ * opened with FI_RMA, reaping completions from that connection's CQ.
+ * Over RDM, ops target the connection's current peer_.
+ * */
+struct RdmaClient {
+  SocketClient *conn_;          /**< Connection carrying the RMA ops */
+  PageBuffer data_;             /**< Local source / sink of RMA ops */
+  struct fid_mr* mr_ = nullptr; /**< Memory region (RDMA) */
+  RmaRegion remote_ = {};       /**< The server's region */
 
-  int ServerInit(const std::string &provider, int port, const std::string &ip_addr) {
+  /** Register a local buffer and look up the server's region */
+  int ClientInit(SocketClient *conn, size_t region_size) {
     int ret;
-
-    // Initialize common data structures between client & server
-    ret = CommonInit(provider, port, ip_addr);
-    if (ret) {
-      return ret;
+    conn_ = conn;
+    if (!data_.Allocate(region_size, conn_->page_kind_)) {
+      return -FI_ENOMEM;
     }
-
-    // Create passive endpoint
-    ret = fi_passive_ep(fabric_, fi_, &pep_, NULL);
+    ret = fi_mr_reg(conn_->domain_, data_.data(), data_.size(),
+                    FI_READ | FI_WRITE, 0, 0, 0, &mr_, NULL);
     if (ret) {
-      HELOG(kError, "Failed to initialize server endpoint");
+      HELOG(kError, "Failed to register memory region");
       return ret;
     }
-
-    // Bind passive endpoint to emission queue
-    ret = fi_pep_bind(pep_, &eq_->fid, 0);
+    ret = MsgBenchClient(conn_).Region(remote_);
     if (ret) {
-      perror("fi_pep_bind(eq)");
       return ret;
     }
-
-    // Bind passive endpoint to completion counter
-    /*ret = fi_pep_bind(pep_, &cntr_->fid,
-                FI_SEND | FI_RECV);
-    if (ret) {
-      HELOG(kError, "Failed to bind completion counter to passive endpoint");
-    }*/
-
-    // Initialize RDMA or Socket
-    if (fi_->caps & FI_RMA) {
-      HILOG(kInfo, "{} {} supports RDMA", ip_addr, provider);
-      ServerInitRDMA();
-    } else {
-      HILOG(kInfo, "{} {} does NOT support RDMA", ip_addr, provider);
-      ServerInitSocket(port);
-    }
-
-    // Listen for new connections
-    ret = fi_listen(pep_);
-    if (ret) {
-      HELOG(kError, "Failed to listen for new connections");
-      return ret;
-    }
-
-    return ret;
+    HILOG(kInfo, "Targeting {} remote bytes (key: {})",
+          remote_.size_, remote_.key_);
+    return 0;
   }
 
-  int ServerInitRDMA() {
-    int ret;
+  /** Post one RMA op of "size" bytes at "offset" into both regions */
+  int PostRma(bool write, size_t size, size_t offset) {
+    return PostRma(write, data_.data() + offset, size, fi_mr_desc(mr_),
+                   offset);
+  }
 
-    // Finish setting up RDMA region
-    data_.resize(KILOBYTES(64));
-    ret = fi_mr_reg(domain_, data_.data(), data_.size(),
-                    FI_READ | FI_WRITE | FI_REMOTE_READ | FI_REMOTE_WRITE,
-                    0, 0, 0, &mr_, NULL);
+  /**
+   * Post one RMA op between a user buffer, registered through the
+   * connection's MrCache, and "remote_offset" in the server's region.
+   * */
+  int PostRmaBuf(bool write, char *buf, size_t size, size_t remote_offset) {
+    struct fid_mr *mr;
+    int ret = conn_->mr_cache_->Find(buf, size, &mr);
     if (ret) {
-      HELOG(kError, "Failed to register memory region");
       return ret;
     }
-
-    return ret;
+    return PostRma(write, buf, size, fi_mr_desc(mr), remote_offset);
   }
 
-  int ServerInitSocket(int port) {
+  /** Post one RMA op between "buf" and "remote_offset" */
+  int PostRma(bool write, char *buf, size_t size, void *desc,
+              size_t remote_offset) {
+    ssize_t ret;
+    while (true) {
+      if (write) {
+        ret = fi_write(conn_->ep_, buf, size, desc, conn_->peer_,
+                       remote_.addr_ + remote_offset, remote_.key_, NULL);
+      } else {
+        ret = fi_read(conn_->ep_, buf, size, desc, conn_->peer_,
+                      remote_.addr_ + remote_offset, remote_.key_, NULL);
+      }
+      if (ret != -FI_EAGAIN) {
+        break;
+      }
+      ret = conn_->ReapCompletions();
+      if (ret < 0) {
+        return (int) ret;
+      }
+    }
+    if (ret) {
+      HELOG(kError, "{} failed: {}", write ? "fi_write" : "fi_read",
+            fi_strerror(-ret));
+      return (int) ret;
+    }
+    conn_->tx_posted_ += 1;
     return 0;
   }
 
-  int ClientInit(const std::string &provider, int port, const std::string &ip_addr) {
-    int ret;
-
-    // Initialize common data structures
-    ret = CommonInit(provider, port, ip_addr);
-    if (ret) {
-      return ret;
-    }
-
-    // Create an active endpoint
-    ret = fi_endpoint(domain_, fi_, &ep_, NULL);
-    if (ret) {
-      HELOG(kError, "Failed to initialize endpoint");
-      return ret;
-    }
-
-    // Bind endpoint to emission queue
-    ret = fi_ep_bind(ep_, &eq_->fid, 0);
-    if (ret) {
-      perror("fi_pep_bind(eq)");
-      return ret;
-    }
-
-    // Bind endpoint to completion counter
-    /*ret = fi_ep_bind(ep_, &cntr_->fid,
-                     FI_SEND | FI_RECV);
-    if (ret) {
-      HELOG(kError, "Failed to bind completion counter to endpoint");
-    }
-    // FI_SEND | FI_RECV | FI_READ | FI_WRITE | FI_REMOTE_READ | FI_REMOTE_WRITE*/
-
-    // Initialize RDMA or Socket
-    ret = fi_connect(ep_, fi_->dest_addr, NULL, 0);
-    if (ret) {
-      perror("fi_connect");
-      return ret;
-    }
-
-    return ret;
+  /** Whether an op of "size" bytes fits in both regions */
+  bool Fits(size_t size) {
+    return size <= remote_.size_ && size <= data_.size();
   }
 
-  int ServerAcceptRdma() {
-    int ret;
-    struct fi_eq_cm_entry entry;
-    uint32_t event;
-
-    // Check if client has connected
-//    ret = fi_eq_read(eq_, &event, &entry, sizeof (entry), 0);
-//    if (ret != sizeof (entry)) {
-//      HILOG(kWarning, "fi_eq_read: {}", strerror(errno));
-//      return (int)ret;
-//    }
-//    if (event != FI_CONNREQ) {
-//      fprintf(stderr, "invalid event %u\n", event);
-//      return -1;
-//    }
-
-    // Accept the endpoint
-    ret = fi_accept(ep_, NULL, 0);
-    if (ret) {
-      HELOG(kError, "Failed to accept endpoint");
-      return ret;
+  /** Time one op at a time, each waited for before the next */
+  int Latency(bool write, size_t size, size_t warmup, size_t iters,
+              LatencyHistogram &hist) {
+    hist.Reset();
+    for (size_t i = 0; i < warmup + iters; ++i) {
+      uint64_t start = NowNsec();
+      int ret = PostRma(write, size, Offset(size, i));
+      if (ret == 0) {
+        ret = conn_->WaitTx();
+      }
+      if (ret) {
+        return ret;
+      }
+      if (i >= warmup) {
+        hist.Record(NowNsec() - start);
+      }
     }
-
-    // Register the client connection
-    clients_.emplace_back();
-    clients_.back()->RegisterClientConn(entry, domain_);
-    return ret;
+    return 0;
   }
 
-  int ServerAcceptTcp() {
-    int ret;
-    struct fi_eq_cm_entry entry;
-    uint32_t event;
-
-    // Accept the endpoint
-    ret = fi_accept(ep_, NULL, 0);
-    if (ret) {
-      HELOG(kError, "Failed to accept endpoint");
-      return ret;
-    }
-
-    // Register the client connection
-    clients_.emplace_back();
-    clients_.back()->RegisterClientConn(entry, domain_);
-    return ret;
+  /** Keep up to "window" ops in flight; "nsec" is the total time */
+  int Bandwidth(bool write, size_t size, size_t window, size_t iters,
+                uint64_t &nsec) {
+    return BandwidthWith(window, iters, nsec, [&](size_t i) {
+      return PostRma(write, size, Offset(size, i));
+    });
   }
 
-  int RegisterClientConn(struct fi_eq_cm_entry &entry, struct fid_domain* domain) {
+  /**
+   * Time ops as above, but "post(i)" posts the i'th op. Used to issue
+   * ops from buffers other than data_.
+   * */
+  template<typename PostT>
+  int BandwidthWith(size_t window, size_t iters, uint64_t &nsec,
+                    PostT &&post) {
     int ret;
-    domain_ = domain;
-
-    // Create endpoint to the server
-    ret = fi_endpoint(domain_, entry.info, &ep_, NULL);
-    if (ret) {
-      HELOG(kError, "Failed to create endpoint");
-      return ret;
+    window = std::max<size_t>(window, 1);
+    uint64_t start = NowNsec();
+    for (size_t i = 0; i < iters; ++i) {
+      ret = conn_->WaitTx(window - 1);
+      if (ret) {
+        return ret;
+      }
+      ret = post(i);
+      if (ret) {
+        return ret;
+      }
     }
-
-    // Open emission queue
-    struct fi_eq_attr eq_attr = {
-        .size = 0,
-        .flags = 0,
-        .wait_obj = FI_WAIT_UNSPEC,
-        .signaling_vector = 0,
-        .wait_set = NULL,
-    };
-    ret = fi_eq_open(fabric_, &eq_attr, &eq_, NULL);
+    ret = conn_->WaitTx();
     if (ret) {
-      HELOG(kError, "Failed to open emission queue")
       return ret;
     }
-    fi_ep_bind(ep_, &eq_->fid,
-               FI_SEND | FI_RECV | FI_READ | FI_WRITE | FI_REMOTE_READ | FI_REMOTE_WRITE);
-
-    // Open completion counter
-    struct fi_cntr_attr cntr_attr;
-    memset(&cntr_attr, 0, sizeof(cntr_attr));
-    ret = fi_cntr_open(domain_, &cntr_attr, &cntr_, NULL);
-    if (ret) {
-      HELOG(kError, "Failed to open completion queue")
-      return ret;
-    }
-    fi_ep_bind(ep_, &cntr_->fid,
-               FI_SEND | FI_RECV | FI_READ | FI_WRITE | FI_REMOTE_READ | FI_REMOTE_WRITE);
-
-    // Enable the ep for
-    ret = fi_enable(ep_);
-    if (ret) {
-      HELOG(kError, "Failed to enable endpoint");
-      return ret;
-    }
-
-    return ret;
-  }
-
-  void Send() {
+    nsec = NowNsec() - start;
+    return 0;
   }
 
-  void Recv() {
+ private:
+  /** Rotate ops of "size" bytes through the region */
+  size_t Offset(size_t size, size_t i) {
+    size_t slots = std::max<size_t>(
+        std::min(remote_.size_, data_.size()) / std::max<size_t>(size, 1), 1);
+    return (i % slots) * size;
   }
 };
 
-#endif  // LIBFABRIC_BENCH_SRC_TCP_CLIENT_H_
+#endif  // LIBFABRIC_BENCH_SRC_RDMA_CLIENT_H_
@@ -13,31 +13,32 @@
 #ifndef LABSTOR_RPC_H_
 #define LABSTOR_RPC_H_
 
-#include <arpa/inet.h>
-#include <netdb.h>
-#include <netinet/in.h>
-#include <sys/socket.h>
-#include <ifaddrs.h>
-
-#include <functional>
-#include <iostream>
-#include <fstream>
 #include <string>
 #include <vector>
 
-#include "labstor/labstor_types.h"
-#include "labstor/config/config_server.h"
+#include "hermes_shm/util/logging.h"
+#include "config_manager.h"
 
 namespace labstor {
 
+typedef uint32_t u32;
+typedef int32_t i32;
+
 /** RPC types */
 enum class RpcType {
   kThallium
 };
 
+/** Direction of a bulk transfer, from the client's point of view */
+enum class IoType {
+  kRead,
+  kWrite,
+  kNone
+};
+
 /** Uniquely identify a host machine */
 struct HostInfo {
-  u32 node_id_;           /**< Hermes-assigned node id */
+  u32 node_id_;           /**< Node id (1-based index into host_names) */
   std::string hostname_;  /**< Host name */
   std::string ip_addr_;   /**< Host IP address */
 
@@ -45,18 +46,21 @@ struct HostInfo {
   explicit HostInfo(const std::string &hostname,
                     const std::string &ip_addr,
                     u32 node_id)
-      : hostname_(hostname), ip_addr_(ip_addr), node_id_(node_id) {}
+      : node_id_(node_id), hostname_(hostname), ip_addr_(ip_addr) {}
 };
 
 /** A structure to represent RPC context. */
 class RpcContext {
  public:
-  ServerConfig *config_;
+  ConfigManager *config_;
   int port_;  /**< port number */
   std::string protocol_;  /**< Libfabric provider */
   std::string domain_;    /**< Libfabric domain */
   u32 node_id_;           /**< the ID of this node */
   int num_threads_;       /**< Number of RPC threads */
+  bool progress_thread_;  /**< Run progress on a dedicated xstream */
+  bool busy_spin_;        /**< Poll for progress instead of blocking */
+  std::string pool_kind_; /**< Argobots pool kind (empty = by busy_spin_) */
   std::vector<HostInfo> hosts_; /**< Hostname and ip addr per-node */
 
  public:
@@ -64,152 +68,74 @@ class RpcContext {
   RpcContext() = default;
 
   /** Get the nubmer of hosts */
-  HSHM_ALWAYS_INLINE
   size_t GetNumHosts() {
     return hosts_.size();
   }
 
   /** initialize host info list */
-  void ServerInit(ServerConfig *config) {
+  void ServerInit(ConfigManager *config) {
     config_ = config;
-    port_ = config_->rpc_.port_;
-    protocol_ = config_->rpc_.protocol_;
-    domain_ = config_->rpc_.domain_;
-    num_threads_ = 4;  // TODO(llogan): Add to configuration
+    port_ = config_->port_;
+    protocol_ = config_->protocol_;
+    domain_ = config_->domain_;
+    num_threads_ = (int)config_->rpc_threads_;
+    progress_thread_ = config_->rpc_progress_thread_;
+    busy_spin_ = config_->rpc_busy_spin_;
+    pool_kind_ = config_->rpc_pool_kind_;
     if (hosts_.size()) { return; }
-    // Uses hosts produced by host_names
-    auto &hosts = config_->rpc_.host_names_;
 
-    // Get all host info
-    hosts_.reserve(hosts.size());
+    // NOTE(llogan): host_names are already resolved to IP addresses
+    hosts_.reserve(config_->host_names_.size());
     u32 node_id = 1;
-    for (const auto& name : hosts) {
-      hosts_.emplace_back(name, _GetIpAddress(name), node_id++);
+    for (const auto& ip_addr : config_->host_names_) {
+      hosts_.emplace_back(ip_addr, ip_addr, node_id++);
     }
 
     // Get id of current host
-    node_id_ = _FindThisHost();
+    node_id_ = config_->_FindThisHost();
     if (node_id_ == 0 || node_id_ > (u32)hosts_.size()) {
       HELOG(kFatal, "Couldn't identify this host.")
     }
   }
 
   /** get RPC address */
-  std::string GetRpcAddress(const DomainId &domain_id, int port) {
-    return GetRpcAddress(DomainId::GetNode(node_id_), port_);
+  std::string GetRpcAddress(u32 node_id, int port) {
+    return protocol_ + "://" + GetIpAddressFromNodeId(node_id) +
+        ":" + std::to_string(port);
   }
 
   /** Get RPC address for this node */
   std::string GetMyRpcAddress() {
-    // NOTE(llogan): node_id 0 is reserved as the NULL node
-    u32 node_id = domain_id.id_;
-    if (node_id <= 0 || node_id > (i32)hosts_.size()) {
-      HELOG(kFatal, "Attempted to get from node {}, which is out of "
-                    "the range 1-{}", node_id, hosts_.size() + 1)
-    }
-    u32 index = node_id - 1;
-    return hosts_[index].hostname_;
+    return GetRpcAddress(node_id_, port_);
   }
 
   /** get host name from node ID */
-  std::string GetHostNameFromNodeId(const DomainId &domain_id) {
-    // NOTE(llogan): node_id 0 is reserved as the NULL node
-    u32 node_id = domain_id.id_;
-    if (node_id <= 0 || node_id > (u32)hosts_.size()) {
-      HELOG(kFatal, "Attempted to get from node {}, which is out of "
-                    "the range 1-{}", node_id, hosts_.size() + 1)
-    }
-    u32 index = node_id - 1;
-    return hosts_[index].ip_addr_;
+  std::string GetHostNameFromNodeId(u32 node_id) {
+    return GetHost(node_id).hostname_;
   }
 
-  /** get host name from node ID */
-  std::string GetIpAddressFromNodeId(const DomainId &domain_id) {
-    return config_->rpc_.protocol_;
+  /** get IP address from node ID */
+  std::string GetIpAddressFromNodeId(u32 node_id) {
+    return GetHost(node_id).ip_addr_;
   }
 
   /** Get RPC protocol */
-  std::string GetProtocol();
-
- private:
-  /** Get the node ID of this machine according to hostfile */
-  int _FindThisHost() {
-    int node_id = 1;
-    for (HostInfo &host : hosts_) {
-      if (_IsAddressLocal(host.ip_addr_)) {
-        return node_id;
-      }
-      ++node_id;
-    }
-    HELOG(kFatal, "Could not identify this host");
-    return -1;
+  std::string GetProtocol() {
+    return protocol_;
   }
 
-  /** Check if an IP address is local */
-  bool _IsAddressLocal(const std::string &addr) {
-    struct ifaddrs* ifAddrList = nullptr;
-    bool found = false;
-
-    if (getifaddrs(&ifAddrList) == -1) {
-      perror("getifaddrs");
-      return false;
-    }
-
-    for (struct ifaddrs* ifAddr = ifAddrList;
-         ifAddr != nullptr; ifAddr = ifAddr->ifa_next) {
-      if (ifAddr->ifa_addr == nullptr ||
-          ifAddr->ifa_addr->sa_family != AF_INET) {
-        continue;
-      }
-
-      struct sockaddr_in* sin =
-          reinterpret_cast<struct sockaddr_in*>(ifAddr->ifa_addr);
-      char ipAddress[INET_ADDRSTRLEN] = {0};
-      inet_ntop(AF_INET, &(sin->sin_addr), ipAddress, INET_ADDRSTRLEN);
-
-      if (addr == ipAddress) {
-        found = true;
-        break;
-      }
-    }
-
-    freeifaddrs(ifAddrList);
-    return found;
-  }
-
-  /** Get IPv4 address from the host with "host_name" */
-  std::string _GetIpAddress(const std::string &host_name) {
-    struct hostent hostname_info = {};
-    struct hostent *hostname_result;
-    int hostname_error = 0;
-    char hostname_buffer[4096] = {};
-#ifdef __APPLE__
-    hostname_result = gethostbyname(host_name.c_str());
-  in_addr **addr_list = (struct in_addr **)hostname_result->h_addr_list;
-#else
-    int gethostbyname_result =
-        gethostbyname_r(host_name.c_str(), &hostname_info, hostname_buffer,
-                        4096, &hostname_result, &hostname_error);
-    if (gethostbyname_result != 0) {
-      HELOG(kFatal, hstrerror(h_errno))
-    }
-    in_addr **addr_list = (struct in_addr **)hostname_info.h_addr_list;
-#endif
-    if (!addr_list[0]) {
-      HELOG(kFatal, hstrerror(h_errno))
-    }
-
-    char ip_address[INET_ADDRSTRLEN] = {0};
-    const char *inet_result =
-        inet_ntop(AF_INET, addr_list[0], ip_address, INET_ADDRSTRLEN);
-    if (!inet_result) {
-      perror("inet_ntop");
-      HELOG(kFatal, "inet_ntop failed");
+ private:
+  /** Get the host with "node_id" */
+  HostInfo& GetHost(u32 node_id) {
+    // NOTE(llogan): node_id 0 is reserved as the NULL node
+    if (node_id <= 0 || node_id > (u32)hosts_.size()) {
+      HELOG(kFatal, "Attempted to get from node {}, which is out of "
+                    "the range 1-{}", node_id, hosts_.size())
     }
-    return ip_address;
+    return hosts_[node_id - 1];
   }
 };
 
-}  // namespace hermes
+}  // namespace labstor
 
 #endif  // LABSTOR_RPC_H_
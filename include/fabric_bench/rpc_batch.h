@@ -0,0 +1,204 @@
+//
+// Created by lukemartinlogan on 10/17/23.
+//
+
+#ifndef FABRIC_INCLUDE_FABRIC_BENCH_RPC_BATCH_H_
+#define FABRIC_INCLUDE_FABRIC_BENCH_RPC_BATCH_H_
+
+#include "rpc_thallium.h"
+#include "histogram.h"
+
+#include <thallium/serialization/stl/string.hpp>
+#include <thallium/serialization/stl/vector.hpp>
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+
+namespace labstor {
+
+/** Executes one call of a batch: serialized arguments in, result out */
+typedef std::function<std::string(const std::string&)> BatchHandler;
+
+/**
+ * Server side of RPC batching: a "Batch" RPC which runs each call it
+ * carries in order and replies with all of their results at once.
+ * */
+class RpcBatchServer {
+ public:
+  std::unordered_map<std::string, BatchHandler> handlers_;
+
+ public:
+  /** Define a call that may be batched. Must precede Register. */
+  void Define(const std::string &name, BatchHandler handler) {
+    handlers_[name] = std::move(handler);
+  }
+
+  /** Register the "Batch" RPC with the server */
+  void Register(ThalliumRpc &rpc) {
+    rpc.RegisterRpc("Batch", [this](const tl::request &req,
+                                    const std::vector<std::string> &names,
+                                    const std::vector<std::string> &args) {
+      std::vector<std::string> results(names.size());
+      for (size_t i = 0; i < names.size(); ++i) {
+        auto it = handlers_.find(names[i]);
+        if (it == handlers_.end()) {
+          HELOG(kError, "No batched call named {}", names[i]);
+          continue;
+        }
+        results[i] = it->second(args[i]);
+      }
+      req.respond(results);
+    });
+  }
+};
+
+/**
+ * Client side of RPC batching. Calls to the same node are collected and
+ * sent as one "Batch" RPC once max_calls_ calls or max_bytes_ bytes of
+ * arguments are pending, or once the oldest pending call has waited
+ * deadline_nsec_. Each call gets a future for its own result.
+ *
+ * A background thread sleeps until the next deadline and sends the
+ * batches which reach it. Each future waits for its batch's response
+ * when its result is asked for, so the client engine needs a progress
+ * xstream (rpc_progress_thread) to make progress on the waiter's behalf.
+ * */
+class RpcBatcher {
+ public:
+  typedef std::shared_ptr<tl::async_response> Response;
+  /** Calls to one node which have not been sent yet */
+  struct Batch {
+    std::vector<std::string> names_;
+    std::vector<std::string> args_;
+    std::promise<Response> sent_;  /**< Set once the batch is sent */
+    std::shared_future<std::vector<std::string>> results_;
+    size_t bytes_ = 0;          /**< Bytes of arguments */
+    uint64_t start_nsec_ = 0;   /**< When the first call was added */
+  };
+  ThalliumRpc *rpc_;
+  size_t max_calls_;            /**< Flush at this many calls */
+  size_t max_bytes_;            /**< Flush at this many argument bytes */
+  uint64_t deadline_nsec_;      /**< Flush calls which waited this long */
+  std::unordered_map<u32, Batch> pending_;  /**< Unsent calls by node */
+  std::mutex lock_;             /**< Protects pending_ */
+  std::condition_variable wake_;  /**< A new deadline or stop_ */
+  bool stop_ = false;
+  std::thread flusher_;
+  size_t batches_ = 0, calls_ = 0;
+
+ public:
+  RpcBatcher(ThalliumRpc *rpc, size_t max_calls, size_t max_bytes,
+             uint64_t deadline_nsec)
+      : rpc_(rpc), max_calls_(std::max<size_t>(max_calls, 1)),
+        max_bytes_(max_bytes), deadline_nsec_(deadline_nsec) {
+    flusher_ = std::thread(&RpcBatcher::FlusherLoop, this);
+  }
+
+  /** Send whatever is pending */
+  ~RpcBatcher() {
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      stop_ = true;
+    }
+    wake_.notify_one();
+    flusher_.join();
+    Flush();
+  }
+
+  /** Queue the call "name" on "node_id" */
+  std::future<std::string> Call(u32 node_id, const std::string &name,
+                                const std::string &args) {
+    std::lock_guard<std::mutex> guard(lock_);
+    Batch &batch = pending_[node_id];
+    if (batch.names_.empty()) {
+      Open(batch);
+      wake_.notify_one();
+    }
+    size_t idx = batch.names_.size();
+    batch.names_.emplace_back(name);
+    batch.args_.emplace_back(args);
+    batch.bytes_ += args.size();
+    std::shared_future<std::vector<std::string>> results = batch.results_;
+    if (batch.names_.size() >= max_calls_ || batch.bytes_ >= max_bytes_) {
+      Send(node_id, batch);
+    }
+    return std::async(std::launch::deferred, [results, idx]() {
+      const std::vector<std::string> &all = results.get();
+      return idx < all.size() ? all[idx] : std::string();
+    });
+  }
+
+  /** Send every pending batch now */
+  void Flush() {
+    std::lock_guard<std::mutex> guard(lock_);
+    for (auto &[node_id, batch] : pending_) {
+      Send(node_id, batch);
+    }
+  }
+
+  /** Average number of calls per batch sent */
+  double CallsPerBatch() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return batches_ ? (double) calls_ / batches_ : 0;
+  }
+
+ private:
+  /**
+   * Start collecting calls in "batch". Its results are fetched by the
+   * first caller to ask for one, once the batch has been sent.
+   * */
+  void Open(Batch &batch) {
+    batch.start_nsec_ = NowNsec();
+    std::shared_future<Response> sent = batch.sent_.get_future().share();
+    batch.results_ = std::async(std::launch::deferred, [sent]() {
+      std::vector<std::string> results = sent.get()->wait();
+      return results;
+    }).share();
+  }
+
+  /** Send "batch" as one RPC & reset it. Requires lock_. */
+  void Send(u32 node_id, Batch &batch) {
+    if (batch.names_.empty()) {
+      return;
+    }
+    batches_ += 1;
+    calls_ += batch.names_.size();
+    batch.sent_.set_value(std::make_shared<tl::async_response>(
+        rpc_->AsyncCall(node_id, "Batch", batch.names_, batch.args_)));
+    batch = Batch();
+  }
+
+  /** Sleep until the oldest pending call's deadline, then send its batch */
+  void FlusherLoop() {
+    std::unique_lock<std::mutex> guard(lock_);
+    while (!stop_) {
+      uint64_t now = NowNsec();
+      uint64_t next = std::numeric_limits<uint64_t>::max();
+      for (auto &[node_id, batch] : pending_) {
+        if (batch.names_.empty()) {
+          continue;
+        }
+        uint64_t due = batch.start_nsec_ + deadline_nsec_;
+        if (now >= due) {
+          Send(node_id, batch);
+        } else {
+          next = std::min(next, due);
+        }
+      }
+      if (next == std::numeric_limits<uint64_t>::max()) {
+        wake_.wait(guard);
+      } else {
+        wake_.wait_for(guard, std::chrono::nanoseconds(next - now));
+      }
+    }
+  }
+};
+
+}  // namespace labstor
+
+#endif  // FABRIC_INCLUDE_FABRIC_BENCH_RPC_BATCH_H_
@@ -14,8 +14,15 @@
 #define HERMES_RPC_THALLIUM_H_
 
 #include <thallium.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include "hermes_shm/util/singleton.h"
+#include "bulk_pool.h"
+#include "histogram.h"
 
 #include "rpc.h"
 
@@ -23,6 +30,18 @@ namespace tl = thallium;
 
 namespace labstor {
 
+/** (pointer, size) pairs moved by a single bulk operation */
+typedef std::vector<std::pair<void*, size_t>> BulkSegments;
+
+/**
+ * An asynchronous I/O call. The client's buffer stays exposed as "bulk_"
+ * until the server has pulled or pushed it, i.e., until "resp_" arrives.
+ * */
+struct AsyncIoResponse {
+  tl::bulk bulk_;
+  tl::async_response resp_;
+};
+
 /**
    A structure to represent Thallium state
 */
@@ -32,6 +51,13 @@ class ThalliumRpc {
   std::unique_ptr<tl::engine> client_engine_; /**< pointer to client engine */
   std::unique_ptr<tl::engine> server_engine_; /**< pointer to server engine */
   RpcContext *rpc_;
+  bool cache_rpcs_ = true;  /**< Reuse endpoints & remote procedures */
+  std::unordered_map<u32, tl::endpoint> endpoints_;  /**< Server by node */
+  std::unordered_map<std::string, tl::remote_procedure> procs_;  /**< By name */
+  std::mutex cache_lock_;   /**< Protects endpoints_ & procs_ */
+  std::unique_ptr<BulkPool> client_pool_;  /**< Pre-exposed client regions */
+  std::unique_ptr<BulkPool> server_pool_;  /**< Pre-exposed server regions */
+  bool use_bulk_pool_ = true;  /**< Whether IoCall borrows from client_pool_ */
 
   /** initialize RPC context  */
   ThalliumRpc() {}
@@ -42,9 +68,12 @@ class ThalliumRpc {
     HILOG(kInfo, "Initializing RPC server");
     std::string addr = rpc->GetMyRpcAddress();
     HILOG(kInfo, "Attempting to start server on: {}", addr);
+    std::string json = GetMargoConfig(rpc->num_threads_);
+    struct margo_init_info args = {};
+    args.json_config = json.c_str();
     try {
       server_engine_ = std::make_unique<tl::engine>(
-          addr, THALLIUM_SERVER_MODE, true, rpc->num_threads_);
+          addr, THALLIUM_SERVER_MODE, &args);
     } catch (std::exception &e) {
       HELOG(kFatal, "RPC init failed for host: {}\n{}", addr, e.what());
     }
@@ -54,18 +83,94 @@ class ThalliumRpc {
           addr,
           rpc->num_threads_,
           rpc->node_id_);
+    HILOG(kInfo, "Progress thread: {}, busy spin: {}, pool kind: {}",
+          rpc->progress_thread_, rpc->busy_spin_, GetPoolKind());
     ClientInit(rpc);
   }
 
-  /** Initialize client */
+  /**
+   * Initialize client. The client engine shares the server's progress
+   * settings, but never runs handlers on xstreams of its own.
+   * */
   void ClientInit(RpcContext *rpc) {
     rpc_ = rpc;
     std::string protocol = rpc->GetProtocol();
+    std::string json = GetMargoConfig(0);
+    struct margo_init_info args = {};
+    args.json_config = json.c_str();
     client_engine_ = std::make_unique<tl::engine>(protocol,
                                                   THALLIUM_CLIENT_MODE,
-                                                  true, 1);
+                                                  &args);
     HILOG(kInfo, "This client is on node {} (i.e., {}, proto: {})",
-          rpc->node_id_, rpc->GetHostNameFromNodeId(DomainId::GetNode(rpc->node_id_)), protocol);
+          rpc->node_id_, rpc->GetHostNameFromNodeId(rpc->node_id_), protocol);
+  }
+
+  /** Argobots pool kind of the progress & handler pools */
+  std::string GetPoolKind() {
+    if (!rpc_->pool_kind_.empty()) {
+      return rpc_->pool_kind_;
+    }
+    return rpc_->busy_spin_ ? "fifo" : "fifo_wait";
+  }
+
+  /**
+   * Margo's JSON configuration for the Argobots topology. Progress runs
+   * on a dedicated xstream or on the primary one. Handlers run on a pool
+   * served by "num_threads" xstreams, or in the progress pool if there
+   * are none. With busy_spin_, xstreams poll their pools and mercury
+   * never blocks waiting for network events.
+   * */
+  std::string GetMargoConfig(int num_threads) {
+    std::string kind = GetPoolKind();
+    std::string sched = kind == "fifo" ? "basic" : "basic_wait";
+    auto pool = [](const std::string &name, const std::string &kind) {
+      return "{\"name\":\"" + name + "\",\"kind\":\"" + kind +
+          "\",\"access\":\"mpmc\"}";
+    };
+    auto xstream = [](const std::string &name, const std::string &sched,
+                      const std::string &pool) {
+      return "{\"name\":\"" + name + "\",\"scheduler\":{\"type\":\"" +
+          sched + "\",\"pools\":[\"" + pool + "\"]}}";
+    };
+    std::string pools = pool("__primary__", "fifo_wait");
+    std::string xstreams = xstream("__primary__", "basic_wait", "__primary__");
+    std::string progress_pool = "__primary__";
+    if (rpc_->progress_thread_) {
+      pools += "," + pool("progress", kind);
+      xstreams += "," + xstream("progress_es", sched, "progress");
+      progress_pool = "progress";
+    }
+    std::string rpc_pool = progress_pool;
+    if (num_threads > 0) {
+      pools += "," + pool("rpc", kind);
+      for (int i = 0; i < num_threads; ++i) {
+        xstreams += "," + xstream("rpc_es_" + std::to_string(i), sched, "rpc");
+      }
+      rpc_pool = "rpc";
+    }
+    return "{\"progress_timeout_ub_msec\":" +
+        std::string(rpc_->busy_spin_ ? "0" : "100") +
+        ",\"mercury\":{\"na_no_block\":" +
+        std::string(rpc_->busy_spin_ ? "true" : "false") +
+        "},\"argobots\":{\"pools\":[" + pools + "],\"xstreams\":[" +
+        xstreams + "]},\"progress_pool\":\"" + progress_pool +
+        "\",\"rpc_pool\":\"" + rpc_pool + "\"}";
+  }
+
+  /** Release cached handles & bulk pools, then shut the engines down */
+  void Finalize() {
+    endpoints_.clear();
+    procs_.clear();
+    client_pool_.reset();
+    server_pool_.reset();
+    if (client_engine_) {
+      client_engine_->finalize();
+      client_engine_.reset();
+    }
+    if (server_engine_) {
+      server_engine_->finalize();
+      server_engine_.reset();
+    }
   }
 
   /** Run the daemon */
@@ -99,17 +204,72 @@ class ThalliumRpc {
 
   /** Stop the thallium daemon */
   void StopAllDaemons() {
-    for (u32 node_id = 1; node_id < (int)rpc_->hosts_.size() + 1; ++node_id) {
+    for (u32 node_id = 1; node_id < (u32)rpc_->hosts_.size() + 1; ++node_id) {
       StopDaemon(node_id);
     }
   }
 
   /** Thallium-compatible server name */
   std::string GetServerName(u32 node_id) {
-    std::string ip_address = rpc_->GetIpAddressFromNodeId(DomainId::GetNode(node_id));
-    return rpc_->protocol_ + "://" +
-        std::string(ip_address) +
-        ":" + std::to_string(rpc_->port_);
+    return rpc_->GetRpcAddress(node_id, rpc_->port_);
+  }
+
+  /**
+   * The endpoint of the server on "node_id". Addresses are looked up
+   * once and then shared by all callers.
+   * */
+  tl::endpoint GetEndpoint(u32 node_id) {
+    if (cache_rpcs_) {
+      std::lock_guard<std::mutex> guard(cache_lock_);
+      auto it = endpoints_.find(node_id);
+      if (it != endpoints_.end()) {
+        return it->second;
+      }
+    }
+    tl::endpoint server = client_engine_->lookup(GetServerName(node_id));
+    if (cache_rpcs_) {
+      std::lock_guard<std::mutex> guard(cache_lock_);
+      endpoints_.emplace(node_id, server);
+    }
+    return server;
+  }
+
+  /** The client-side handle of the RPC "func_name", defined once */
+  tl::remote_procedure GetProcedure(const char *func_name) {
+    if (cache_rpcs_) {
+      std::lock_guard<std::mutex> guard(cache_lock_);
+      auto it = procs_.find(func_name);
+      if (it != procs_.end()) {
+        return it->second;
+      }
+    }
+    tl::remote_procedure remote_proc = client_engine_->define(func_name);
+    if (cache_rpcs_) {
+      std::lock_guard<std::mutex> guard(cache_lock_);
+      procs_.emplace(func_name, remote_proc);
+    }
+    return remote_proc;
+  }
+
+  /**
+   * Expose "count" regions of "region_size" bytes on each engine up
+   * front. Transfers up to "region_size" bytes then copy through a
+   * borrowed region instead of exposing their buffer.
+   * */
+  void InitBulkPools(size_t count, size_t region_size) {
+    if (count == 0) {
+      return;
+    }
+    client_pool_ = std::make_unique<BulkPool>();
+    if (!client_pool_->Init(*client_engine_, count, region_size)) {
+      HELOG(kFatal, "Failed to allocate the client bulk pool");
+    }
+    if (server_engine_) {
+      server_pool_ = std::make_unique<BulkPool>();
+      if (!server_pool_->Init(*server_engine_, count, region_size)) {
+        HELOG(kFatal, "Failed to allocate the server bulk pool");
+      }
+    }
   }
 
   /** Register an RPC with thallium */
@@ -123,10 +283,9 @@ class ThalliumRpc {
   thallium::async_response AsyncCall(u32 node_id, const char *func_name, Args&&... args) {
     HILOG(kDebug, "Calling {} {} -> {}", func_name, rpc_->node_id_, node_id)
     try {
-      std::string server_name = GetServerName(node_id);
-      tl::remote_procedure remote_proc = client_engine_->define(func_name);
-      tl::endpoint server = client_engine_->lookup(server_name);
-      HILOG(kDebug, "Found the server: {}={}", node_id, server_name)
+      tl::remote_procedure remote_proc = GetProcedure(func_name);
+      tl::endpoint server = GetEndpoint(node_id);
+      HILOG(kDebug, "Found the server: {}", node_id)
       return remote_proc.on(server).async(std::forward<Args>(args)...);
     } catch (tl::margo_exception &err) {
       HELOG(kFatal, "Thallium failed on function: {}\n{}",
@@ -135,12 +294,14 @@ class ThalliumRpc {
     }
   }
 
-  /** I/O transfers */
+  /**
+   * I/O transfers. Synchronous transfers that fit in client_pool_ copy
+   * through a pre-exposed region instead of exposing "data".
+   * */
   template<typename ReturnType, bool ASYNC, typename ...Args>
   ReturnType IoCall(i32 node_id, const char *func_name,
                     IoType type, char *data, size_t size, Args&& ...args) {
     HILOG(kDebug, "Calling {} {} -> {}", func_name, rpc_->node_id_, node_id)
-    std::string server_name = GetServerName(node_id);
     tl::bulk_mode flag;
     switch (type) {
       case IoType::kRead: {
@@ -160,22 +321,94 @@ class ThalliumRpc {
       }
     }
 
-    tl::remote_procedure remote_proc = client_engine_->define(func_name);
-    tl::endpoint server = client_engine_->lookup(server_name);
+    tl::remote_procedure remote_proc = GetProcedure(func_name);
+    tl::endpoint server = GetEndpoint(node_id);
 
     std::vector<std::pair<void*, size_t>> segments(1);
     segments[0].first  = data;
     segments[0].second = size;
 
-    tl::bulk bulk = client_engine_->expose(segments, flag);
     if constexpr (!ASYNC) {
+      BulkRegion *region = nullptr;
+      if (use_bulk_pool_ && client_pool_) {
+        region = client_pool_->Borrow(size);
+      }
+      tl::bulk bulk;
+      if (region) {
+        bulk = region->bulk_;
+        if (type == IoType::kWrite) {
+          memcpy(region->data_, data, size);
+        }
+      } else {
+        bulk = client_engine_->expose(segments, flag);
+      }
+      auto release = [&]() {
+        if (region) {
+          if (type == IoType::kRead) {
+            memcpy(data, region->data_, size);
+          }
+          client_pool_->Return(region);
+        }
+      };
       if constexpr (std::is_same_v<ReturnType, void>) {
         remote_proc.on(server)(bulk, std::forward<Args>(args)...);
+        release();
       } else {
-        return remote_proc.on(server)(bulk, std::forward<Args>(args)...);
+        ReturnType ret = remote_proc.on(server)(bulk,
+                                                std::forward<Args>(args)...);
+        release();
+        return ret;
       }
     } else {
-      return remote_proc.on(server).async(bulk, std::forward<Args>(args)...);
+      tl::bulk bulk = client_engine_->expose(segments, flag);
+      tl::async_response resp =
+          remote_proc.on(server).async(bulk, std::forward<Args>(args)...);
+      return ReturnType{std::move(bulk), std::move(resp)};
+    }
+  }
+
+  /** Bulk mode of the client's buffer for an I/O of "type" */
+  static tl::bulk_mode ClientBulkMode(IoType type) {
+    // Reads modify the client's buffer, writes only read from it
+    return type == IoType::kRead ? tl::bulk_mode::write_only :
+                                   tl::bulk_mode::read_only;
+  }
+
+  /**
+   * Expose "size" bytes of "data" for I/Os of "type" once, so callers
+   * can pass the bulk to many calls instead of exposing per call
+   * */
+  tl::bulk Expose(char *data, size_t size, IoType type) {
+    BulkSegments segments(1, {data, size});
+    return client_engine_->expose(segments, ClientBulkMode(type));
+  }
+
+  /** Total number of bytes in "segments" */
+  static size_t SegmentsSize(const BulkSegments &segments) {
+    size_t size = 0;
+    for (auto &segment : segments) {
+      size += segment.second;
+    }
+    return size;
+  }
+
+  /**
+   * Synchronous scatter-gather I/O: all "segments" are exposed as one
+   * bulk handle, so the server moves them in a single bulk operation
+   * without the client packing them first.
+   * */
+  template<typename ReturnType, typename ...Args>
+  ReturnType SgIoCall(i32 node_id, const char *func_name, IoType type,
+                      const BulkSegments &segments, Args&& ...args) {
+    HILOG(kDebug, "Calling {} {} -> {} ({} segments)", func_name,
+          rpc_->node_id_, node_id, segments.size())
+    tl::remote_procedure remote_proc = GetProcedure(func_name);
+    tl::endpoint server = GetEndpoint(node_id);
+    tl::bulk bulk = client_engine_->expose(segments, ClientBulkMode(type));
+    if constexpr (std::is_same_v<ReturnType, void>) {
+      remote_proc.on(server)(bulk, std::forward<Args>(args)...);
+    } else {
+      return remote_proc.on(server)(bulk, std::forward<Args>(args)...);
     }
   }
 
@@ -187,25 +420,31 @@ class ThalliumRpc {
         node_id, func_name, type, data, size, std::forward<Args>(args)...);
   }
 
-  /** I/O transfers */
+  /** Asynchronous I/O transfer: "data" is exposed until it is waited on */
   template<typename ...Args>
-  thallium::async_response AsyncIoCall(u32 node_id, const char *func_name,
-                                       IoType type, char *data, size_t size,
-                                       Args&& ...args) {
-    return IoCall<thallium::async_response, true>(
+  AsyncIoResponse AsyncIoCall(u32 node_id, const char *func_name,
+                              IoType type, char *data, size_t size,
+                              Args&& ...args) {
+    return IoCall<AsyncIoResponse, true>(
         node_id, func_name, type, data, size, std::forward<Args>(args)...);
   }
 
-  /** Io transfer at the server */
+  /**
+   * Io transfer at the server. If "pooled" and the transfer fits in
+   * server_pool_, it is staged in a pre-exposed region instead of
+   * exposing "data". The client's bulk may be larger than "size" (e.g.,
+   * one of its own pool regions), so only "size" bytes are moved.
+   * */
   size_t IoCallServer(const tl::request &req, const tl::bulk &bulk,
-                      IoType type, char *data, size_t size) {
+                      IoType type, char *data, size_t size,
+                      bool pooled = true) {
     tl::bulk_mode flag = tl::bulk_mode::write_only;
     switch (type) {
       case IoType::kRead: {
         // The "local_bulk" object will only be read from
         flag = tl::bulk_mode::read_only;
         // flag = tl::bulk_mode::read_write;
-        HILOG(kInfo, "(node {}) Reading {} bytes from the server",
+        HILOG(kDebug, "(node {}) Reading {} bytes from the server",
               rpc_->node_id_, size)
         break;
       }
@@ -213,7 +452,7 @@ class ThalliumRpc {
         // The "local_bulk" object will only be written to
         flag = tl::bulk_mode::write_only;
         // flag = tl::bulk_mode::read_write;
-        HILOG(kInfo, "(node {}) Writing {} bytes to the server",
+        HILOG(kDebug, "(node {}) Writing {} bytes to the server",
               rpc_->node_id_, size)
         break;
       }
@@ -227,19 +466,33 @@ class ThalliumRpc {
     std::vector<std::pair<void*, size_t>> segments(1);
     segments[0].first  = data;
     segments[0].second = size;
-    tl::bulk local_bulk = server_engine_->expose(segments, flag);
+    BulkRegion *region = nullptr;
+    if (pooled && server_pool_) {
+      region = server_pool_->Borrow(size);
+    }
+    tl::bulk local_bulk;
+    if (region) {
+      local_bulk = region->bulk_;
+      if (type == IoType::kRead) {
+        memcpy(region->data_, data, size);
+      }
+    } else {
+      local_bulk = server_engine_->expose(segments, flag);
+    }
     size_t io_bytes = 0;
 
     try {
       switch (type) {
         case IoType::kRead: {
           // Read from "local_bulk" to "bulk"
-          io_bytes = bulk.on(endpoint) << local_bulk;
+          io_bytes = bulk.on(endpoint).select(0, size) <<
+              local_bulk.select(0, size);
           break;
         }
         case IoType::kWrite: {
           // Write to "local_bulk" from "bulk"
-          io_bytes = bulk.on(endpoint) >> local_bulk;
+          io_bytes = bulk.on(endpoint).select(0, size) >>
+              local_bulk.select(0, size);
           break;
         }
         case IoType::kNone: {
@@ -250,12 +503,115 @@ class ThalliumRpc {
       HELOG(kFatal, "(node {}) Failed to perform bulk I/O thallium: {} (type={})",
             rpc_->node_id_, e.what(), (type==IoType::kRead)?"read":"write");
     }
+    if (region) {
+      if (type == IoType::kWrite) {
+        memcpy(data, region->data_, size);
+      }
+      server_pool_->Return(region);
+    }
+    if (io_bytes != size) {
+      HELOG(kFatal, "Failed to perform bulk I/O thallium")
+    }
+    return io_bytes;
+  }
+
+  /**
+   * Scatter-gather Io transfer at the server: moves the client's bulk
+   * to or from all of "segments" in a single bulk operation.
+   * */
+  size_t SgIoCallServer(const tl::request &req, const tl::bulk &bulk,
+                        IoType type, const BulkSegments &segments) {
+    tl::endpoint endpoint = req.get_endpoint();
+    size_t size = SegmentsSize(segments);
+    tl::bulk local_bulk = server_engine_->expose(
+        segments, type == IoType::kRead ? tl::bulk_mode::read_only :
+                                          tl::bulk_mode::write_only);
+    size_t io_bytes = 0;
+    try {
+      if (type == IoType::kRead) {
+        io_bytes = bulk.on(endpoint).select(0, size) <<
+            local_bulk.select(0, size);
+      } else {
+        io_bytes = bulk.on(endpoint).select(0, size) >>
+            local_bulk.select(0, size);
+      }
+    } catch (std::exception &e) {
+      HELOG(kFatal, "(node {}) Failed to perform bulk I/O thallium: {}",
+            rpc_->node_id_, e.what());
+    }
     if (io_bytes != size) {
       HELOG(kFatal, "Failed to perform bulk I/O thallium")
     }
     return io_bytes;
   }
 
+  /**
+   * Pipelined Io transfer at the server. Moves "size" bytes in chunks of
+   * "chunk_size", with up to "depth" chunks in flight (one ULT each), so
+   * transferring one chunk overlaps with processing another.
+   * "on_chunk(offset, len)" runs on each chunk of "data": after it
+   * lands for writes, or before it is pushed for reads. "first_nsec"
+   * is when the first chunk finished transferring.
+   * */
+  template<typename ChunkF>
+  size_t IoCallServerChunked(const tl::request &req, const tl::bulk &bulk,
+                             IoType type, char *data, size_t size,
+                             size_t chunk_size, size_t depth,
+                             ChunkF &&on_chunk, uint64_t &first_nsec) {
+    tl::endpoint endpoint = req.get_endpoint();
+    std::vector<std::pair<void*, size_t>> segments(1);
+    segments[0].first  = data;
+    segments[0].second = size;
+    tl::bulk local_bulk = server_engine_->expose(
+        segments, type == IoType::kRead ? tl::bulk_mode::read_only :
+                                          tl::bulk_mode::write_only);
+    chunk_size = std::max<size_t>(chunk_size, 1);
+    size_t num_chunks = (size + chunk_size - 1) / chunk_size;
+    std::atomic<size_t> next_chunk = 0;
+    std::atomic<size_t> io_bytes = 0;
+    std::atomic<uint64_t> first = 0;
+
+    // Each ULT claims the next chunk until none are left
+    auto pipeline = [&]() {
+      size_t chunk;
+      while ((chunk = next_chunk.fetch_add(1)) < num_chunks) {
+        size_t off = chunk * chunk_size;
+        size_t len = std::min(chunk_size, size - off);
+        try {
+          if (type == IoType::kRead) {
+            on_chunk(off, len);
+            io_bytes += bulk.on(endpoint).select(off, len) <<
+                local_bulk.select(off, len);
+          } else {
+            io_bytes += bulk.on(endpoint).select(off, len) >>
+                local_bulk.select(off, len);
+          }
+          uint64_t none = 0;
+          first.compare_exchange_strong(none, NowNsec());
+          if (type == IoType::kWrite) {
+            on_chunk(off, len);
+          }
+        } catch (std::exception &e) {
+          HELOG(kFatal, "(node {}) Failed to transfer chunk {}: {}",
+                rpc_->node_id_, chunk, e.what());
+        }
+      }
+    };
+    std::vector<tl::managed<tl::thread>> ults;
+    for (size_t i = 1; i < std::min(depth, num_chunks); ++i) {
+      ults.emplace_back(tl::xstream::self().make_thread(pipeline));
+    }
+    pipeline();
+    for (auto &ult : ults) {
+      ult->join();
+    }
+    if (io_bytes != size) {
+      HELOG(kFatal, "Failed to perform bulk I/O thallium")
+    }
+    first_nsec = first.load();
+    return io_bytes;
+  }
+
   /** Check if request is complete */
   bool IsDone(thallium::async_response &req) {
     return req.received();
@@ -265,11 +621,24 @@ class ThalliumRpc {
   template<typename RetT>
   RetT Wait(thallium::async_response &req) {
     if constexpr(std::is_same_v<void, RetT>) {
-      req.wait().as<RetT>();
+      req.wait();
     } else {
       return req.wait();
     }
   }
+
+  /** Wait for an I/O call, then release the bulk it exposed */
+  template<typename RetT>
+  RetT Wait(AsyncIoResponse &req) {
+    if constexpr(std::is_same_v<void, RetT>) {
+      Wait<void>(req.resp_);
+      req.bulk_ = tl::bulk();
+    } else {
+      RetT ret = Wait<RetT>(req.resp_);
+      req.bulk_ = tl::bulk();
+      return ret;
+    }
+  }
 };
 
 }  // namespace hermes
@@ -288,4 +657,8 @@ class ThalliumRpc {
     mode = static_cast<T>(cast);\
   }
 
+namespace labstor {
+SERIALIZE_ENUM(IoType)
+}  // namespace labstor
+
 #endif  // HERMES_RPC_THALLIUM_H_
@@ -0,0 +1,65 @@
+//
+// Created by lukemartinlogan on 10/17/23.
+//
+
+#ifndef FABRIC_INCLUDE_FABRIC_BENCH_RUN_TOGETHER_H_
+#define FABRIC_INCLUDE_FABRIC_BENCH_RUN_TOGETHER_H_
+
+#include "histogram.h"
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+/**
+ * Run "fn(i)" for each i below "count" on its own thread, releasing
+ * them all together. "setup(i)", if given, runs on thread i before the
+ * release (e.g., to pin it). Returns the first nonzero return of fn.
+ * */
+static inline int RunTogether(
+    size_t count, const std::function<int(size_t)> &fn,
+    const std::function<void(size_t)> &setup = nullptr) {
+  std::vector<std::thread> threads;
+  std::vector<int> rets(count, 0);
+  std::atomic<size_t> ready = 0;
+  for (size_t i = 0; i < count; ++i) {
+    threads.emplace_back([&, i]() {
+      if (setup) {
+        setup(i);
+      }
+      ready.fetch_add(1);
+      while (ready.load() < count) {}
+      rets[i] = fn(i);
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  for (int ret : rets) {
+    if (ret) {
+      return ret;
+    }
+  }
+  return 0;
+}
+
+/**
+ * RunTogether where each "fn(i, hist)" records latencies into a
+ * histogram of its own. They are merged into "hist" once all finish.
+ * */
+static inline int RunLatencyTogether(
+    size_t count, const std::function<int(size_t, LatencyHistogram&)> &fn,
+    LatencyHistogram &hist) {
+  std::vector<LatencyHistogram> hists(count);
+  int ret = RunTogether(count, [&](size_t i) {
+    return fn(i, hists[i]);
+  });
+  hist.Reset();
+  for (LatencyHistogram &thread_hist : hists) {
+    hist.Merge(thread_hist);
+  }
+  return ret;
+}
+
+#endif  // FABRIC_INCLUDE_FABRIC_BENCH_RUN_TOGETHER_H_
@@ -0,0 +1,129 @@
+//
+// Created by lukemartinlogan on 10/17/23.
+//
+
+#ifndef FABRIC_INCLUDE_FABRIC_BENCH_SHARD_BENCH_H_
+#define FABRIC_INCLUDE_FABRIC_BENCH_SHARD_BENCH_H_
+
+#include "socket_client.h"
+#include "msg_bench.h"
+#include "run_together.h"
+
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+
+/** How worker threads are given their own endpoints */
+enum class ShardMode : int {
+  kEndpoint = 0,  /**< Shared domain (FI_THREAD_ENDPOINT), one ep each */
+  kDomain = 1,    /**< One domain (FI_THREAD_DOMAIN) and ep each */
+};
+
+/**
+ * One connection per worker thread. Each worker drives its own endpoint
+ * and CQ so no two threads ever touch the same libfabric object.
+ * */
+struct ShardedClient {
+  std::vector<std::unique_ptr<SocketClient>> shards_;
+  ShardMode mode_ = ShardMode::kEndpoint;
+  bool pin_ = false;  /**< Pin worker i to core i */
+  PageKind page_kind_ = PageKind::kSmall;  /**< Pages backing payloads */
+
+  /** Parse "endpoint" or "domain" */
+  static ShardMode ParseMode(const std::string &name) {
+    if (name == "endpoint") {
+      return ShardMode::kEndpoint;
+    } else if (name == "domain") {
+      return ShardMode::kDomain;
+    }
+    HELOG(kFatal, "Unknown shard mode: {}", name);
+    return ShardMode::kEndpoint;
+  }
+
+  /**
+   * Open & connect "num_shards" endpoints, each waiting on its CQ
+   * according to "progress". "wait_obj" must support that policy.
+   * */
+  int Init(ShardMode mode, size_t num_shards, const std::string &provider,
+           int port, const std::string &ip_addr, size_t max_msg_size,
+           const CqProgress &progress, enum fi_wait_obj wait_obj) {
+    int ret;
+    mode_ = mode;
+    for (size_t i = 0; i < num_shards; ++i) {
+      auto shard = std::make_unique<SocketClient>();
+      shard->progress_ = progress;
+      shard->cq_attr.wait_obj = wait_obj;
+      shard->page_kind_ = page_kind_;
+      if (mode_ == ShardMode::kDomain) {
+        shard->threading_ = FI_THREAD_DOMAIN;
+        ret = shard->ClientInit(provider, port, ip_addr);
+      } else if (i == 0) {
+        shard->threading_ = FI_THREAD_ENDPOINT;
+        ret = shard->ClientInit(provider, port, ip_addr);
+      } else {
+        ret = shard->ClientInit(*shards_[0]);
+      }
+      if (ret) {
+        HELOG(kError, "Failed to connect shard {}", i);
+        return ret;
+      }
+      ret = shard->RegisterBuffers(max_msg_size);
+      if (ret) {
+        return ret;
+      }
+      shards_.emplace_back(std::move(shard));
+    }
+    return 0;
+  }
+
+  /**
+   * Stream "iters" messages on each of the first "num_threads" shards
+   * concurrently. All threads start together; "rate" is the total
+   * number of messages per second over the slowest thread's time.
+   * */
+  int MsgRate(size_t num_threads, size_t msg_size, size_t window,
+              size_t iters, double &rate) {
+    num_threads = std::min(num_threads, shards_.size());
+    std::vector<uint64_t> nsecs(num_threads, 0);
+    int ret = RunTogether(num_threads, [&](size_t i) {
+      return MsgBenchClient(shards_[i].get()).Stream(msg_size, window, iters,
+                                                     nsecs[i]);
+    }, [&](size_t i) {
+      if (pin_) {
+        Pin(i);
+      }
+    });
+    if (ret) {
+      return ret;
+    }
+    uint64_t nsec = 1;
+    for (uint64_t thread_nsec : nsecs) {
+      nsec = std::max(nsec, thread_nsec);
+    }
+    rate = 1e9 * num_threads * iters / nsec;
+    return 0;
+  }
+
+  /** Tell the server every shard is done */
+  int Stop() {
+    for (auto &shard : shards_) {
+      int ret = MsgBenchClient(shard.get()).Stop();
+      if (ret) {
+        return ret;
+      }
+    }
+    return 0;
+  }
+
+  /** Pin the calling thread to a core */
+  static void Pin(size_t core) {
+    size_t num_cores = std::max<size_t>(std::thread::hardware_concurrency(),
+                                        1);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core % num_cores, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+};
+
+#endif  // FABRIC_INCLUDE_FABRIC_BENCH_SHARD_BENCH_H_
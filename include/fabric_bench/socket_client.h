@@ -6,11 +6,15 @@
 #define LIBFABRIC_BENCH_SRC_TCP_CLIENT_H_
 
 #include "hermes_shm/util/logging.h"
+#include "cq_progress.h"
+#include "mr_cache.h"
+#include "page_buffer.h"
 
 #include <vector>
 #include <list>
 #include <string>
 #include <memory>
+#include <algorithm>
 
 #include <rdma/fabric.h>
 #include <rdma/fi_domain.h>
@@ -18,20 +22,47 @@
 #include <rdma/fi_cm.h>
 
 struct SocketClient {
-  std::vector<char> data_;
+  PageBuffer data_;             /**< Send half, then receive half */
+  size_t max_msg_size_ = 0;     /**< Size of each half of data_ */
   struct fi_info* info_;          /**< General fabric info */
   struct fi_info *hints_;       /**< Properties for creating info */
   struct fid_fabric* fabric_;   /**< Fabric ID */
   struct fid_domain* domain_;   /**< Fabric domain */
-  struct fid_av *av_;           /**< Address vector */
-  struct fid_ep* ep_;           /**< Active endpoint */
-  struct fid_eq *eq_;           /**< Emission queue (RDMA) */
-  struct fid_cq *cq_;           /**< Completion queue (RDMA) */
+  struct fid_av *av_ = nullptr; /**< Address vector (RDM) */
+  struct fid_ep* ep_ = nullptr; /**< Active endpoint */
+  struct fid_eq *eq_ = nullptr; /**< Emission queue (RDMA) */
+  struct fid_cq *cq_ = nullptr; /**< Completion queue (RDMA) */
+  struct fid_mr* mr_ = nullptr; /**< Registration of data_ */
+  size_t tx_posted_ = 0;        /**< Number of sends posted */
+  size_t tx_done_ = 0;          /**< Number of sends completed */
+  size_t rx_posted_ = 0;        /**< Number of receives posted */
+  size_t rx_done_ = 0;          /**< Number of receives completed */
+  size_t rx_consumed_ = 0;      /**< Number of receives returned by Recv */
+  size_t rx_len_ = 0;           /**< Length of the last received message */
+  char *rx_data_ = nullptr;     /**< Where the last message landed */
+  CqProgress progress_;         /**< How to wait on cq_ */
+  enum fi_threading threading_ = FI_THREAD_UNSPEC;  /**< Domain threading hint */
+  uint64_t caps_ = FI_MSG;      /**< FI_MSG, optionally with FI_RMA */
+  enum fi_ep_type ep_type_ = FI_EP_MSG;  /**< FI_EP_MSG or FI_EP_RDM */
+  fi_addr_t peer_ = FI_ADDR_UNSPEC;      /**< Destination of sends (RDM) */
+  std::vector<fi_addr_t> peers_;         /**< Peers inserted into av_ */
+  MrCache *mr_cache_ = nullptr; /**< Registers user buffers */
+  PageKind page_kind_ = PageKind::kSmall;  /**< Pages backing data_ */
+  bool inject_ = false;         /**< Inject sends under inject_size */
+  bool use_cntr_ = false;       /**< Count sends & RMA with cntr_ */
+  struct fid_cntr *cntr_ = nullptr;  /**< Completion counter */
+  bool multi_recv_ = false;     /**< Receive into FI_MULTI_RECV buffers */
+  size_t multi_recv_size_ = 0;  /**< Size of each multi-receive buffer */
+  size_t multi_recv_count_ = 2; /**< Number of multi-receive buffers */
+  size_t multi_reposts_ = 0;    /**< Multi-receive buffers released */
+  PageBuffer multi_data_;       /**< Backing store of multi-receive bufs */
+  struct fid_mr *multi_mr_ = nullptr;  /**< Registration of multi_data_ */
   std::string ip_addr_, port_str_;
   struct fi_eq_attr eq_attr = {
       .wait_obj = FI_WAIT_UNSPEC,
   };
   struct fi_cq_attr cq_attr = {
+      .format = FI_CQ_FORMAT_DATA,
       .wait_obj = FI_WAIT_NONE,
   };
 
@@ -43,6 +74,17 @@ struct SocketClient {
     return ret;
   }
 
+  /** Parse "msg" or "rdm" */
+  static enum fi_ep_type ParseEpType(const std::string &name) {
+    if (name == "msg" || name.empty()) {
+      return FI_EP_MSG;
+    } else if (name == "rdm") {
+      return FI_EP_RDM;
+    }
+    HELOG(kFatal, "Unknown endpoint type: {}", name);
+    return FI_EP_MSG;
+  }
+
   int ClientInit(const std::string &provider, int port, const std::string &ip_addr) {
     int ret;
 
@@ -50,9 +92,10 @@ struct SocketClient {
     // Allocate fabric info
     hints_ = fi_allocinfo();
     hints_->fabric_attr->prov_name = copy_string(provider);
-    hints_->caps = FI_MSG;
-    hints_->ep_attr->type = FI_EP_MSG;
+    hints_->caps = caps_;
+    hints_->ep_attr->type = ep_type_;
     hints_->domain_attr->mr_mode = FI_MR_BASIC;
+    hints_->domain_attr->threading = threading_;
     ip_addr_ = ip_addr;
     port_str_ = std::to_string(port);
     ret = fi_getinfo(FI_VERSION(1, 14),
@@ -74,6 +117,34 @@ struct SocketClient {
       HELOG(kError, "Failed to initialize domain");
       return ret;
     }
+    if (ep_type_ == FI_EP_RDM) {
+      return OpenRdm();
+    }
+    return Connect();
+  }
+
+  /**
+   * Connect another endpoint through the fabric and domain of "parent".
+   * Only valid if the domain was opened with a threading level that
+   * allows each endpoint to be driven by a different thread.
+   * */
+  int ClientInit(SocketClient &parent) {
+    info_ = parent.info_;
+    hints_ = nullptr;
+    fabric_ = parent.fabric_;
+    domain_ = parent.domain_;
+    threading_ = parent.threading_;
+    caps_ = parent.caps_;
+    page_kind_ = parent.page_kind_;
+    inject_ = parent.inject_;
+    ip_addr_ = parent.ip_addr_;
+    port_str_ = parent.port_str_;
+    return Connect();
+  }
+
+  /** Open an endpoint, EQ & CQ on domain_ and connect to the server */
+  int Connect() {
+    int ret;
 
     // Create an active endpoint
     ret = fi_endpoint(domain_, info_, &ep_, NULL);
@@ -95,16 +166,39 @@ struct SocketClient {
     }
 
     // Create completion queue
-//    ret = fi_cq_open(domain_, &cq_attr, &cq_, NULL);
-//    if (ret) {
-//      perror("fi_cq_open");
-//      return ret;
-//    }
-//    ret = fi_ep_bind(ep_, &cq_->fid, FI_TRANSMIT | FI_RECV | FI_SEND);
-//    if (ret) {
-//      perror("fi_pep_bind(cq)");
-//      return ret;
-//    }
+    ret = fi_cq_open(domain_, &cq_attr, &cq_, NULL);
+    if (ret) {
+      perror("fi_cq_open");
+      return ret;
+    }
+    // Selective completion only applies to sends: receives always
+    // complete through the CQ
+    ret = fi_ep_bind(ep_, &cq_->fid, FI_TRANSMIT |
+                     (use_cntr_ ? FI_SELECTIVE_COMPLETION : 0));
+    if (ret == 0) {
+      ret = fi_ep_bind(ep_, &cq_->fid, FI_RECV);
+    }
+    if (ret) {
+      perror("fi_ep_bind(cq)");
+      return ret;
+    }
+
+    // Count sends & RMA with a counter instead of CQ entries
+    if (use_cntr_) {
+      struct fi_cntr_attr cntr_attr = {};
+      cntr_attr.events = FI_CNTR_EVENTS_COMP;
+      cntr_attr.wait_obj = cq_attr.wait_obj;
+      ret = fi_cntr_open(domain_, &cntr_attr, &cntr_, NULL);
+      if (ret) {
+        HELOG(kError, "Failed to open completion counter")
+        return ret;
+      }
+      ret = fi_ep_bind(ep_, &cntr_->fid, FI_SEND | FI_WRITE | FI_READ);
+      if (ret) {
+        HELOG(kError, "Failed to bind completion counter to endpoint");
+        return ret;
+      }
+    }
 
     // Connect to server
     ret = fi_connect(ep_, info_->dest_addr, NULL, 0);
@@ -131,13 +225,527 @@ struct SocketClient {
       return -FI_EOTHER;
     }
 
+    return 0;
+  }
+
+  /**
+   * Open a connectionless endpoint with its own AV & CQ on domain_.
+   * Instead of connecting, peers are inserted into av_ and sends go to
+   * whichever of them peer_ names.
+   * */
+  int OpenRdm() {
+    int ret;
+
+    // Create the endpoint
+    ret = fi_endpoint(domain_, info_, &ep_, NULL);
+    if (ret) {
+      HELOG(kError, "Failed to initialize endpoint");
+      return ret;
+    }
+
+    // Open the address vector
+    struct fi_av_attr av_attr = {};
+    av_attr.type = FI_AV_TABLE;
+    ret = fi_av_open(domain_, &av_attr, &av_, NULL);
+    if (ret) {
+      HELOG(kError, "Failed to open address vector: {}", fi_strerror(-ret));
+      return ret;
+    }
+    ret = fi_ep_bind(ep_, &av_->fid, 0);
+    if (ret) {
+      perror("fi_ep_bind(av)");
+      return ret;
+    }
+
+    // Create completion queue
+    ret = fi_cq_open(domain_, &cq_attr, &cq_, NULL);
+    if (ret) {
+      perror("fi_cq_open");
+      return ret;
+    }
+    ret = fi_ep_bind(ep_, &cq_->fid, FI_TRANSMIT | FI_RECV);
+    if (ret) {
+      perror("fi_ep_bind(cq)");
+      return ret;
+    }
+
+    // Enable the ep
+    ret = fi_enable(ep_);
+    if (ret) {
+      HELOG(kError, "Failed to enable endpoint: {}", fi_strerror(-ret));
+      return ret;
+    }
+    return 0;
+  }
+
+  /**
+   * Set up the server's RDM endpoint. It stays up for the whole run, so
+   * clients only need their hello (see MsgBenchClient::Hello) to be
+   * inserted into av_ before running benchmarks.
+   * */
+  int ListenInit(struct fid_fabric *fabric, struct fid_domain *domain,
+                 struct fi_info *info, size_t max_msg_size) {
+    int ret;
+    info_ = info;
+    hints_ = nullptr;
+    fabric_ = fabric;
+    domain_ = domain;
+    ret = OpenRdm();
+    if (ret) {
+      return ret;
+    }
+    ret = RegisterBuffers(max_msg_size);
+    if (ret) {
+      return ret;
+    }
+    return PostRecv();
+  }
+
+  /** Insert the server at "port_str_" on each host into av_ */
+  int InsertPeers(const std::vector<std::string> &hosts) {
+    for (const std::string &host : hosts) {
+      fi_addr_t peer;
+      int ret = fi_av_insertsvc(av_, host.c_str(), port_str_.c_str(),
+                                &peer, 0, NULL);
+      if (ret != 1) {
+        HELOG(kError, "Failed to insert {}:{} into the AV", host, port_str_);
+        return ret < 0 ? ret : -FI_EINVAL;
+      }
+      peers_.push_back(peer);
+    }
+    return 0;
+  }
+
+  /** Insert a raw endpoint name (from fi_getname) into av_ */
+  int InsertPeer(const void *name, fi_addr_t &peer) {
+    int ret = fi_av_insert(av_, name, 1, &peer, 0, NULL);
+    if (ret != 1) {
+      HELOG(kError, "Failed to insert a peer into the AV");
+      return ret < 0 ? ret : -FI_EINVAL;
+    }
+    return 0;
+  }
+
+  /**
+   * Close what AcceptInit opened for this connection: the endpoint, its
+   * queues, counter and registrations. The fabric & domain belong to
+   * the server and stay open.
+   * */
+  void CloseAccepted() {
+    if (ep_) {
+      fi_close(&ep_->fid);
+      ep_ = nullptr;
+    }
+    if (mr_) {
+      fi_close(&mr_->fid);
+      mr_ = nullptr;
+    }
+    if (multi_mr_) {
+      fi_close(&multi_mr_->fid);
+      multi_mr_ = nullptr;
+    }
+    if (cntr_) {
+      fi_close(&cntr_->fid);
+      cntr_ = nullptr;
+    }
+    if (cq_) {
+      fi_close(&cq_->fid);
+      cq_ = nullptr;
+    }
+    if (eq_) {
+      fi_close(&eq_->fid);
+      eq_ = nullptr;
+    }
+  }
+
+  /**
+   * Set up the server side of a connection from a FI_CONNREQ.
+   * The endpoint shares the server's fabric and domain, but gets its
+   * own EQ and CQ. A receive is posted before accepting so the first
+   * message from the client always has somewhere to land.
+   * */
+  int AcceptInit(struct fid_fabric *fabric, struct fid_domain *domain,
+                 struct fi_info *info, size_t max_msg_size) {
+    int ret;
+    info_ = info;
+    hints_ = nullptr;
+    fabric_ = fabric;
+    domain_ = domain;
+
+    // Create endpoint to the client
+    ret = fi_endpoint(domain_, info_, &ep_, NULL);
+    if (ret) {
+      HELOG(kError, "Failed to create endpoint");
+      return ret;
+    }
+
+    // Open emission queue
+    ret = fi_eq_open(fabric_, &eq_attr, &eq_, NULL);
+    if (ret) {
+      HELOG(kError, "Failed to open emission queue")
+      return ret;
+    }
+    ret = fi_ep_bind(ep_, &eq_->fid, 0);
+    if (ret) {
+      perror("fi_ep_bind(eq)");
+      return ret;
+    }
+
+    // Open completion queue
+    ret = fi_cq_open(domain_, &cq_attr, &cq_, NULL);
+    if (ret) {
+      perror("fi_cq_open");
+      return ret;
+    }
+    ret = fi_ep_bind(ep_, &cq_->fid, FI_TRANSMIT | FI_RECV);
+    if (ret) {
+      perror("fi_ep_bind(cq)");
+      return ret;
+    }
+
+    // Retire multi-receive buffers once a full message no longer fits
+    if (multi_recv_) {
+      size_t min_multi_recv = std::max<size_t>(max_msg_size, 64);
+      ret = fi_setopt(&ep_->fid, FI_OPT_ENDPOINT, FI_OPT_MIN_MULTI_RECV,
+                      &min_multi_recv, sizeof(min_multi_recv));
+      if (ret) {
+        HELOG(kError, "Failed to set min_multi_recv: {}", fi_strerror(-ret));
+        return ret;
+      }
+    }
+
+    // Enable the ep
+    ret = fi_enable(ep_);
+    if (ret) {
+      HELOG(kError, "Failed to enable endpoint");
+      return ret;
+    }
+
+    // Register buffers & pre-post the first receive
+    ret = RegisterBuffers(max_msg_size);
+    if (ret) {
+      return ret;
+    }
+    if (multi_recv_) {
+      ret = InitMultiRecv();
+      if (ret) {
+        return ret;
+      }
+    }
+    ret = PostRecv();
+    if (ret) {
+      return ret;
+    }
+
+    // Accept the connection
+    ret = fi_accept(ep_, NULL, 0);
+    if (ret) {
+      HELOG(kError, "Failed to accept endpoint: {}", fi_strerror(-ret));
+      return ret;
+    }
+
+    // Wait for the connection to be established
+    struct fi_eq_cm_entry entry;
+    uint32_t event;
+    ssize_t rc = fi_eq_sread(eq_, &event, &entry, sizeof entry, -1, 0);
+    if (rc != sizeof entry) {
+      HELOG(kError, "Failed to wait for connection: {}", fi_strerror(-rc));
+      return (int) rc;
+    }
+    if (event != FI_CONNECTED || entry.fid != &ep_->fid) {
+      HELOG(kError, "Unexpected CM event: {}", event);
+      return -FI_EOTHER;
+    }
+    return 0;
+  }
+
+  /** Allocate & register the send and receive halves of data_ */
+  int RegisterBuffers(size_t max_msg_size) {
+    int ret;
+    // NOTE(llogan): control messages must always fit
+    max_msg_size_ = std::max<size_t>(max_msg_size, 64);
+    if (!data_.Allocate(2 * max_msg_size_, page_kind_)) {
+      return -FI_ENOMEM;
+    }
+    ret = fi_mr_reg(domain_, data_.data(), data_.size(),
+                    FI_SEND | FI_RECV, 0, 0, 0, &mr_, NULL);
+    if (ret) {
+      HELOG(kError, "Failed to register memory region: {}", fi_strerror(-ret));
+      return ret;
+    }
+    return 0;
+  }
+
+  /** The buffer sends are posted from */
+  char* TxBuf() {
+    return data_.data();
+  }
+
+  /** The buffer receives are posted to */
+  char* RxBuf() {
+    return data_.data() + max_msg_size_;
+  }
+
+  /** Post a send of "size" bytes from TxBuf */
+  int PostSend(size_t size) {
+    return PostSend(TxBuf(), size, fi_mr_desc(mr_));
+  }
+
+  /** Post a send from a user buffer, registered through mr_cache_ */
+  int PostSendBuf(const void *buf, size_t size) {
+    struct fid_mr *mr;
+    int ret = mr_cache_->Find(buf, size, &mr);
+    if (ret) {
+      return ret;
+    }
+    return PostSend(buf, size, fi_mr_desc(mr));
+  }
+
+  /**
+   * Post a send of "size" bytes from "buf", registered as "desc".
+   * With inject_, sends that fit under the provider's inject_size go
+   * through fi_inject instead: the buffer is reusable on return and no
+   * completion is generated, so they are not counted in tx_posted_.
+   * */
+  int PostSend(const void *buf, size_t size, void *desc) {
+    ssize_t ret;
+    if (inject_ && size <= info_->tx_attr->inject_size) {
+      return PostInject(buf, size);
+    }
+    while ((ret = fi_send(ep_, buf, size, desc, peer_, NULL)) == -FI_EAGAIN) {
+      ret = ReapCompletions();
+      if (ret < 0) {
+        return (int) ret;
+      }
+    }
+    if (ret) {
+      HELOG(kError, "fi_send failed: {}", fi_strerror(-ret));
+      return (int) ret;
+    }
+    tx_posted_ += 1;
+    return 0;
+  }
+
+  /** Inject a small send. No completion is generated. */
+  int PostInject(const void *buf, size_t size) {
+    ssize_t ret;
+    while ((ret = fi_inject(ep_, buf, size, peer_)) == -FI_EAGAIN) {
+      ret = ReapCompletions();
+      if (ret < 0) {
+        return (int) ret;
+      }
+    }
+    if (ret) {
+      HELOG(kError, "fi_inject failed: {}", fi_strerror(-ret));
+      return (int) ret;
+    }
+    return 0;
+  }
+
+  /** Largest send the provider can inject */
+  size_t InjectSize() {
+    return info_->tx_attr->inject_size;
+  }
+
+  /**
+   * Allocate, register & post the multi-receive buffers. Each is reposted
+   * as soon as the provider releases it (see ReapCompletions).
+   * */
+  int InitMultiRecv() {
+    int ret;
+    multi_recv_size_ = std::max(multi_recv_size_, 2 * max_msg_size_);
+    if (!multi_data_.Allocate(multi_recv_count_ * multi_recv_size_,
+                              page_kind_)) {
+      return -FI_ENOMEM;
+    }
+    ret = fi_mr_reg(domain_, multi_data_.data(), multi_data_.size(),
+                    FI_RECV, 0, 0, 0, &multi_mr_, NULL);
+    if (ret) {
+      HELOG(kError, "Failed to register multi-receive buffers: {}",
+            fi_strerror(-ret));
+      return ret;
+    }
+    for (size_t i = 0; i < multi_recv_count_; ++i) {
+      ret = PostMultiRecv(i);
+      if (ret) {
+        return ret;
+      }
+    }
+    return 0;
+  }
+
+  /** Post multi-receive buffer "idx"; its index is the op context */
+  int PostMultiRecv(size_t idx) {
+    ssize_t ret;
+    struct iovec iov;
+    iov.iov_base = multi_data_.data() + idx * multi_recv_size_;
+    iov.iov_len = multi_recv_size_;
+    void *desc = fi_mr_desc(multi_mr_);
+    struct fi_msg msg = {};
+    msg.msg_iov = &iov;
+    msg.desc = &desc;
+    msg.iov_count = 1;
+    msg.addr = FI_ADDR_UNSPEC;
+    msg.context = reinterpret_cast<void*>(idx);
+    while ((ret = fi_recvmsg(ep_, &msg, FI_MULTI_RECV)) == -FI_EAGAIN) {
+      ret = ReapCompletions();
+      if (ret < 0) {
+        return (int) ret;
+      }
+    }
+    if (ret) {
+      HELOG(kError, "fi_recvmsg(FI_MULTI_RECV) failed: {}", fi_strerror(-ret));
+      return (int) ret;
+    }
+    return 0;
+  }
+
+  /**
+   * Post a receive of up to max_msg_size_ bytes to RxBuf. With
+   * multi_recv_, the multi-receive buffers are always posted, so this
+   * only counts the message the caller expects.
+   * */
+  int PostRecv() {
+    ssize_t ret;
+    if (multi_recv_) {
+      rx_posted_ += 1;
+      return 0;
+    }
+    while ((ret = fi_recv(ep_, RxBuf(), max_msg_size_, fi_mr_desc(mr_),
+                          FI_ADDR_UNSPEC, NULL)) == -FI_EAGAIN) {
+      ret = ReapCompletions();
+      if (ret < 0) {
+        return (int) ret;
+      }
+    }
+    if (ret) {
+      HELOG(kError, "fi_recv failed: {}", fi_strerror(-ret));
+      return (int) ret;
+    }
+    rx_posted_ += 1;
+    return 0;
+  }
+
+  /** Whether the client of an accepted connection has shut it down */
+  bool PeerShutdown() {
+    if (ep_type_ != FI_EP_MSG || eq_ == nullptr) {
+      return false;
+    }
+    struct fi_eq_cm_entry entry;
+    uint32_t event;
+    ssize_t rc = fi_eq_read(eq_, &event, &entry, sizeof(entry), 0);
+    return rc == sizeof(entry) && event == FI_SHUTDOWN;
+  }
+
+  /**
+   * Read whatever completions are ready. If "block", wait for at least
+   * one according to progress_. Returns the number reaped.
+   * */
+  ssize_t ReapCompletions(bool block = false) {
+    struct fi_cq_data_entry comps[16];
+    ssize_t ret = block ? progress_.Wait(cq_, comps, 16) :
+        fi_cq_read(cq_, comps, 16);
+    if (ret == -FI_EAGAIN) {
+      return 0;
+    }
+    if (ret == -FI_EAVAIL) {
+      struct fi_cq_err_entry err_entry = {};
+      fi_cq_readerr(cq_, &err_entry, 0);
+      HELOG(kError, "Completion error: {} {}", err_entry.err,
+            fi_cq_strerror(cq_, err_entry.prov_errno,
+                           err_entry.err_data, NULL, 0));
+      return -err_entry.err;
+    }
+    if (ret < 0) {
+      HELOG(kError, "fi_cq_read failed: {}", fi_strerror(-ret));
+      return ret;
+    }
+    for (ssize_t i = 0; i < ret; ++i) {
+      uint64_t flags = comps[i].flags;
+      if (flags & FI_MULTI_RECV) {
+        // NOTE(llogan): the buffer is reposted before the message in it
+        // is consumed. Only commands are ever read, and clients send
+        // nothing else until a command is acked.
+        multi_reposts_ += 1;
+        int rc = PostMultiRecv(reinterpret_cast<size_t>(comps[i].op_context));
+        if (rc) {
+          return rc;
+        }
+        if (comps[i].len == 0) {
+          continue;
+        }
+      }
+      if (flags & FI_RECV) {
+        rx_done_ += 1;
+        rx_len_ = comps[i].len;
+        rx_data_ = multi_recv_ ? reinterpret_cast<char*>(comps[i].buf) :
+            RxBuf();
+      } else {
+        tx_done_ += 1;
+      }
+    }
     return ret;
   }
 
-  void Send() {
+  /**
+   * Wait until at most "depth" sends are still outstanding. With
+   * use_cntr_, sends & RMA produce no CQ entries and are counted by
+   * cntr_ instead.
+   * */
+  int WaitTx(size_t depth = 0) {
+    if (use_cntr_) {
+      if (tx_posted_ - tx_done_ <= depth) {
+        return 0;
+      }
+      int ret = progress_.WaitCntr(cntr_, tx_posted_ - depth, tx_done_);
+      if (ret) {
+        HELOG(kError, "Completion counter error: {}", fi_strerror(-ret));
+      }
+      return ret;
+    }
+    while (tx_posted_ - tx_done_ > depth) {
+      ssize_t ret = ReapCompletions(true);
+      if (ret < 0) {
+        return (int) ret;
+      }
+    }
+    return 0;
+  }
+
+  /** Wait until at most "depth" receives are still outstanding */
+  int WaitRx(size_t depth = 0) {
+    while (rx_posted_ - rx_done_ > depth) {
+      ssize_t ret = ReapCompletions(true);
+      if (ret < 0) {
+        return (int) ret;
+      }
+    }
+    return 0;
   }
 
-  void Recv() {
+  /** Send "size" bytes from TxBuf and wait for the send to complete */
+  int Send(size_t size) {
+    int ret = PostSend(size);
+    if (ret) {
+      return ret;
+    }
+    return WaitTx();
+  }
+
+  /**
+   * Wait for the next receive to complete. Completions may already have
+   * been reaped while waiting on sends, so this counts against the
+   * receives previously returned rather than the CQ.
+   * */
+  int Recv() {
+    while (rx_done_ == rx_consumed_) {
+      ssize_t ret = ReapCompletions(true);
+      if (ret < 0) {
+        return (int) ret;
+      }
+    }
+    rx_consumed_ += 1;
+    return 0;
   }
 };
 
@@ -6,10 +6,24 @@
 #define LIBFABRIC_BENCH_SRC_TCP_SERVER_H_
 
 #include "socket_client.h"
+#include "rdma_server.h"
+#include "msg_bench.h"
+#include <atomic>
+#include <limits>
+#include <mutex>
 #include <thread>
 
+/** A progress thread serving a subset of the server's connections */
+struct ProgressWorker {
+  std::mutex lock_;                      /**< Protects pending_ */
+  std::vector<SocketClient*> pending_;   /**< Accepted, not yet served */
+  std::list<MsgBenchServer> benches_;    /**< Connections being served */
+  std::thread thread_;
+};
+
 struct SocketServer {
-  std::vector<char> data_;
+  static const int kAcceptPollMs = 100;
+  PageBuffer data_;
   struct fi_info* info_;          /**< General fabric info */
   struct fi_info *hints_;       /**< Properties for creating info */
   struct fid_fabric* fabric_;   /**< Fabric ID */
@@ -20,9 +34,25 @@ struct SocketServer {
   struct fid_eq *eq_;           /**< Emission queue */
   struct fid_cq *cq_;           /**< Completion queue */
   struct fid_mr* mr_;           /**< Memory region (RDMA) */
+  uint64_t caps_ = FI_MSG;      /**< FI_MSG, optionally with FI_RMA */
+  enum fi_ep_type ep_type_ = FI_EP_MSG;  /**< FI_EP_MSG or FI_EP_RDM */
+  size_t rma_region_size_ = 0;  /**< Size of the region clients target */
+  RdmaServer rdma_;             /**< Region published for RMA */
+  PageKind page_kind_ = PageKind::kSmall;  /**< Pages backing payloads */
+  size_t multi_recv_size_ = 0;  /**< Multi-receive buffer size (FI_MULTI_RECV) */
+  size_t multi_recv_count_ = 2; /**< Multi-receive buffers per client */
   std::list<std::unique_ptr<SocketClient>> clients_;
+  std::mutex clients_lock_;     /**< Protects clients_ */
   std::unique_ptr<std::thread> accept_thread_;
+  std::vector<std::unique_ptr<ProgressWorker>> workers_;
+  size_t num_workers_ = 1;      /**< Number of progress threads */
+  size_t num_clients_ = 1;      /**< Clients to wait for (0 = run forever) */
+  bool poll_all_ = false;       /**< Never block on one CQ (e.g., incast) */
+  std::atomic<size_t> num_done_ = 0;  /**< Number of clients finished */
+  std::atomic<bool> stop_ = false;    /**< Stop accepting & serving */
   std::string ip_addr_, port_str_;
+  size_t max_msg_size_;         /**< Largest benchmark message */
+  enum fi_wait_obj cq_wait_obj_ = FI_WAIT_NONE;  /**< Per-client CQ wait object */
   struct fi_eq_attr eq_attr = {
       .wait_obj = FI_WAIT_UNSPEC,
   };
@@ -34,14 +64,16 @@ struct SocketServer {
     return ret;
   }
 
-  int ServerInit(const std::string &provider, int port, const std::string &ip_addr) {
+  int ServerInit(const std::string &provider, int port, const std::string &ip_addr,
+                 size_t max_msg_size) {
     int ret;
+    max_msg_size_ = max_msg_size;
 
     // Allocate hints
     hints_ = fi_allocinfo();
     hints_->fabric_attr->prov_name = copy_string(provider);
-    hints_->caps = FI_MSG;
-    hints_->ep_attr->type = FI_EP_MSG;
+    hints_->caps = caps_;
+    hints_->ep_attr->type = ep_type_;
     hints_->domain_attr->mr_mode = FI_MR_BASIC;
     hints_->addr_format = FI_SOCKADDR_IN;
     ip_addr_ = ip_addr;
@@ -66,6 +98,40 @@ struct SocketServer {
       return ret;
     }
 
+    // Initialize RDMA or Socket
+    if (caps_ & FI_RMA) {
+      HILOG(kInfo, "{} {} supports RDMA", ip_addr, provider);
+      rdma_.page_kind_ = page_kind_;
+      ret = rdma_.ServerInitRDMA(domain_, info_, rma_region_size_);
+      if (ret) {
+        return ret;
+      }
+    }
+
+    // Progress threads
+    workers_.reserve(num_workers_);
+    for (size_t i = 0; i < std::max<size_t>(num_workers_, 1); ++i) {
+      workers_.emplace_back(std::make_unique<ProgressWorker>());
+    }
+    if (ep_type_ == FI_EP_RDM) {
+      ret = ListenRdm();
+    } else {
+      ret = ListenMsg();
+    }
+    if (ret) {
+      return ret;
+    }
+    for (auto &worker : workers_) {
+      worker->thread_ = std::thread(&SocketServer::ProgressLoop, this,
+                                    worker.get());
+    }
+    return ret;
+  }
+
+  /** Listen for connections on a passive endpoint */
+  int ListenMsg() {
+    int ret;
+
     // Create passive endpoint
     ret = fi_passive_ep(fabric_, info_, &pep_, NULL);
     if (ret) {
@@ -94,83 +160,216 @@ struct SocketServer {
 
     // Accept thread
     HILOG(kInfo, "Starting accept thread");
-    ServerAccept();
-    // accept_thread_ = std::make_unique<std::thread>(&SocketServer::ServerAccept, this);
-
+    accept_thread_ = std::make_unique<std::thread>(&SocketServer::AcceptLoop, this);
     return ret;
   }
 
+  /**
+   * Serve every client from a single RDM endpoint bound to the listen
+   * address. There is nothing to accept: clients introduce themselves
+   * with a hello, and the endpoint serves one client at a time.
+   * */
+  int ListenRdm() {
+    auto conn = std::make_unique<SocketClient>();
+    conn->ep_type_ = FI_EP_RDM;
+    conn->cq_attr.wait_obj = cq_wait_obj_;
+    conn->progress_.timeout_ms_ = kAcceptPollMs;
+    conn->page_kind_ = page_kind_;
+    int ret = conn->ListenInit(fabric_, domain_, info_, max_msg_size_);
+    if (ret) {
+      HELOG(kError, "Failed to open the RDM endpoint");
+      return ret;
+    }
+    workers_[0]->pending_.push_back(conn.get());
+    clients_.emplace_back(std::move(conn));
+    HILOG(kInfo, "Serving RDM clients on {}:{}", ip_addr_, port_str_);
+    return 0;
+  }
+
+  /** Wait for all expected clients to finish, then print their stats */
   void Join() {
-    accept_thread_->join();
+    if (accept_thread_) {
+      accept_thread_->join();
+    }
+    for (auto &worker : workers_) {
+      worker->thread_.join();
+    }
+    PrintStats();
+    // Accepted connections own the fi_info of their FI_CONNREQ
+    for (auto &client : clients_) {
+      if (client->ep_type_ == FI_EP_MSG && client->info_) {
+        fi_freeinfo(client->info_);
+        client->info_ = nullptr;
+      }
+    }
+  }
+
+  /** Accept connections until the server is stopped */
+  void AcceptLoop() {
+    while (!stop_) {
+      int ret = ServerAccept();
+      if (ret && ret != -FI_EAGAIN) {
+        HELOG(kError, "Accept failed: {}", fi_strerror(-ret));
+      }
+    }
   }
 
+  /**
+   * Accept one connection and hand it to a progress thread.
+   * Returns -FI_EAGAIN if nobody connected within the poll interval.
+   * */
   int ServerAccept() {
     int ret;
     uint32_t event;
     struct fi_eq_cm_entry entry;
 
-    while (true) {
-      // Detect connection request
-      ret = fi_eq_sread(eq_, &event, &entry, sizeof(entry), -1, 0);
-      if (ret != sizeof(entry)) {
-        HILOG(kError, "Failed to read from event queue: {}", fi_strerror(-ret));
-        return ret;
-      }
-      if (event != FI_CONNREQ) {
-        HILOG(kError, "Unexpected event: {}", event);
-        return -1;
-      }
-      HILOG(kInfo, "Received connection request");
+    // Detect connection request
+    ssize_t rc = fi_eq_sread(eq_, &event, &entry, sizeof(entry),
+                             kAcceptPollMs, 0);
+    if (rc == -FI_EAGAIN) {
+      return (int) rc;
+    }
+    if (rc != sizeof(entry)) {
+      HILOG(kError, "Failed to read from event queue: {}", fi_strerror(-rc));
+      return (int) rc;
+    }
+    if (event != FI_CONNREQ) {
+      HILOG(kError, "Unexpected event: {}", event);
+      return -1;
+    }
+    HILOG(kInfo, "Received connection request");
 
-      // Accept the endpoint
-      ret = fi_accept(ep_, NULL, 0);
-      if (ret) {
-        HELOG(kError, "Failed to accept endpoint");
-        return ret;
-      }
+    // Register the client connection
+    auto client = std::make_unique<SocketClient>();
+    client->cq_attr.wait_obj = cq_wait_obj_;
+    client->progress_.timeout_ms_ = kAcceptPollMs;
+    client->page_kind_ = page_kind_;
+    client->multi_recv_ = caps_ & FI_MULTI_RECV;
+    client->multi_recv_size_ = multi_recv_size_;
+    client->multi_recv_count_ = multi_recv_count_;
+    ret = client->AcceptInit(fabric_, domain_, entry.info, max_msg_size_);
+    if (ret) {
+      HELOG(kError, "Failed to accept client connection");
+      client->CloseAccepted();
+      fi_freeinfo(entry.info);
+      return ret;
+    }
 
-      // Register the client connection
-      clients_.emplace_back();
-      auto &client = clients_.back();
+    // Assign the client to a progress thread round-robin
+    SocketClient *conn = client.get();
+    size_t client_id;
+    {
+      std::lock_guard<std::mutex> guard(clients_lock_);
+      client_id = clients_.size();
+      clients_.emplace_back(std::move(client));
+    }
+    ProgressWorker &worker = *workers_[client_id % workers_.size()];
+    {
+      std::lock_guard<std::mutex> guard(worker.lock_);
+      worker.pending_.push_back(conn);
+    }
+    HILOG(kInfo, "Accepted connection {}", client_id);
+    return ret;
+  }
 
-      // Create endpoint to the server
-      ret = fi_endpoint(domain_, client->info_, &ep_, NULL);
-      if (ret) {
-        HELOG(kError, "Failed to create endpoint");
-        return ret;
+  /**
+   * Serve the connections assigned to "worker" until the server stops.
+   * A worker that can only ever own one connection waits on its CQ
+   * according to the client's policy; otherwise it polls every CQ. With
+   * poll_all_, connections may arrive at any time (as in incast), so
+   * workers always poll. Waits time out after kAcceptPollMs, so a worker
+   * notices stop_ and clients which disconnected without a stop command.
+   * */
+  void ProgressLoop(ProgressWorker *worker) {
+    bool dedicated = !poll_all_ && num_clients_ &&
+        num_clients_ <= workers_.size();
+    while (!stop_) {
+      {
+        std::lock_guard<std::mutex> guard(worker->lock_);
+        for (SocketClient *conn : worker->pending_) {
+          worker->benches_.emplace_back(conn);
+          if (caps_ & FI_RMA) {
+            worker->benches_.back().region_ = &rdma_.region_;
+          }
+        }
+        worker->pending_.clear();
       }
-
-      // Open emission queue
-      struct fi_eq_attr eq_attr = {
-          .size = 0,
-          .flags = 0,
-          .wait_obj = FI_WAIT_UNSPEC,
-          .signaling_vector = 0,
-          .wait_set = NULL,
-      };
-      ret = fi_eq_open(fabric_, &eq_attr, &eq_, NULL);
-      if (ret) {
-        HELOG(kError, "Failed to open emission queue")
-        return ret;
+      size_t active = 0;
+      for (MsgBenchServer &bench : worker->benches_) {
+        if (bench.done_) {
+          continue;
+        }
+        size_t rx_done = bench.conn_->rx_done_;
+        int ret = bench.Poll(dedicated);
+        if (ret) {
+          HELOG(kError, "Client failed: {}", fi_strerror(-ret));
+          bench.done_ = true;
+        } else if (!bench.done_ && bench.conn_->rx_done_ == rx_done &&
+                   bench.conn_->PeerShutdown()) {
+          HELOG(kError, "Client disconnected without stopping");
+          bench.done_ = true;
+        }
+        if (bench.done_) {
+          ClientDone();
+          // An RDM endpoint is reused by the next client
+          if (bench.conn_->ep_type_ == FI_EP_RDM) {
+            bench.done_ = false;
+          }
+        } else {
+          ++active;
+        }
       }
-      fi_ep_bind(ep_, &eq_->fid,
-                 FI_SEND | FI_RECV | FI_READ | FI_WRITE | FI_REMOTE_READ | FI_REMOTE_WRITE);
-
-      // Enable the ep for
-      ret = fi_enable(ep_);
-      if (ret) {
-        HELOG(kError, "Failed to enable endpoint");
-        return ret;
+      if (active == 0) {
+        std::this_thread::yield();
       }
-
-      return ret;
     }
   }
 
-  void Send() {
+  /**
+   * Stop the server once at least num_clients_ clients are done and
+   * every accepted connection (including extra connections those clients
+   * opened) has stopped. An RDM endpoint counts once per client served.
+   * */
+  void ClientDone() {
+    size_t num_done = num_done_.fetch_add(1) + 1;
+    std::lock_guard<std::mutex> guard(clients_lock_);
+    if (num_clients_ && num_done >= num_clients_ &&
+        num_done >= clients_.size()) {
+      stop_ = true;
+    }
   }
 
-  void Recv() {
+  /** Per-client and aggregate throughput of the payload received */
+  void PrintStats() {
+    uint64_t first = std::numeric_limits<uint64_t>::max(), last = 0;
+    size_t total_bytes = 0;
+    size_t reposts = 0;
+    for (auto &client : clients_) {
+      reposts += client->multi_reposts_;
+    }
+    printf("# server: %zu clients, %zu progress threads, recv: %s",
+           clients_.size(), workers_.size(),
+           (caps_ & FI_MULTI_RECV) ? "multi" : "per-message");
+    if (caps_ & FI_MULTI_RECV) {
+      printf(" (%zu buffers released)", reposts);
+    }
+    printf("\n");
+    printf("%8s %16s %12s\n", "client", "rx_bytes", "GB/s");
+    size_t client_id = 0;
+    for (auto &worker : workers_) {
+      for (MsgBenchServer &bench : worker->benches_) {
+        uint64_t nsec = std::max<uint64_t>(bench.last_nsec_ - bench.first_nsec_, 1);
+        printf("%8zu %16zu %12.3f\n", client_id++, bench.rx_bytes_,
+               (double) bench.rx_bytes_ / nsec);
+        first = std::min(first, bench.first_nsec_);
+        last = std::max(last, bench.last_nsec_);
+        total_bytes += bench.rx_bytes_;
+      }
+    }
+    if (total_bytes) {
+      printf("%8s %16zu %12.3f\n", "total", total_bytes,
+             (double) total_bytes / std::max<uint64_t>(last - first, 1));
+    }
   }
 };
 
@@ -5,6 +5,533 @@
 #include "fabric_bench/config_manager.h"
 #include "fabric_bench/socket_client.h"
 #include "fabric_bench/socket_server.h"
+#include "fabric_bench/msg_bench.h"
+#include "fabric_bench/shard_bench.h"
+#include "fabric_bench/incast_bench.h"
+#include "fabric_bench/provider_probe.h"
+#include "fabric_bench/rdma_client.h"
+#include "fabric_bench/mr_cache.h"
+
+/**
+ * Ping-pong each message size under each CQ policy and print its latency
+ * distribution, along with the CPU this thread burned while waiting.
+ * */
+int PingPongSweep(SocketClient &client, ConfigManager &config) {
+  MsgBenchClient bench(&client);
+  LatencyHistogram hist;
+  printf("# ping-pong latency (provider: %s, pages: %s)\n",
+         config.protocol_.c_str(), PageBuffer::KindName(client.data_.kind_));
+  printf("%8s %12s %10s %10s %10s %10s %10s %10s %8s\n",
+         "policy", "size(B)", "iters", "min(us)", "p50(us)", "p99(us)",
+         "p99.9(us)", "max(us)", "cpu(%)");
+  for (const std::string &policy : config.cq_policies_) {
+    client.progress_.policy_ = CqProgress::ParsePolicy(policy);
+    for (size_t msg_size : config.GetMsgSizes()) {
+      uint64_t cpu_start = ThreadCpuNsec();
+      uint64_t wall_start = NowNsec();
+      int ret = bench.PingPong(msg_size, config.warmup_, config.iterations_,
+                               hist);
+      if (ret) {
+        HELOG(kError, "Ping-pong failed at size {}", msg_size);
+        return ret;
+      }
+      double cpu = 100.0 * (ThreadCpuNsec() - cpu_start) /
+          (NowNsec() - wall_start);
+      printf("%8s %12zu %10zu %10.2f %10.2f %10.2f %10.2f %10.2f %8.1f\n",
+             policy.c_str(), msg_size, config.iterations_,
+             hist.Min() / 1000.0, hist.Percentile(50) / 1000.0,
+             hist.Percentile(99) / 1000.0, hist.Percentile(99.9) / 1000.0,
+             hist.Max() / 1000.0, cpu);
+    }
+  }
+  client.progress_.policy_ = CqProgress::ParsePolicy(config.cq_policies_[0]);
+  return 0;
+}
+
+/** Stream each message size at each window depth and print bandwidth */
+int StreamSweep(SocketClient &client, ConfigManager &config) {
+  MsgBenchClient bench(&client);
+  printf("# streaming bandwidth (provider: %s, pages: %s)\n",
+         config.protocol_.c_str(), PageBuffer::KindName(client.data_.kind_));
+  printf("%12s %8s %10s %12s %12s\n",
+         "size(B)", "window", "iters", "GB/s", "Mmsg/s");
+  for (size_t msg_size : config.GetMsgSizes()) {
+    for (size_t window : config.windows_) {
+      uint64_t nsec;
+      int ret = bench.Stream(msg_size, window, config.warmup_, nsec);
+      if (ret == 0) {
+        ret = bench.Stream(msg_size, window, config.iterations_, nsec);
+      }
+      if (ret) {
+        HELOG(kError, "Stream failed at size {} window {}", msg_size, window);
+        return ret;
+      }
+      double bytes = static_cast<double>(msg_size) * config.iterations_;
+      printf("%12zu %8zu %10zu %12.3f %12.3f\n",
+             msg_size, window, config.iterations_,
+             bytes / nsec, config.iterations_ * 1000.0 / nsec);
+    }
+  }
+  return 0;
+}
+
+/**
+ * Measure message rate as threads are added, each thread streaming on
+ * its own endpoint & CQ.
+ * */
+int ShardSweep(SocketClient &client, ConfigManager &config) {
+  ShardedClient sharded;
+  std::vector<size_t> thread_counts = config.GetThreadCounts();
+  size_t msg_size = config.min_msg_size_;
+  size_t window = config.windows_.back();
+  sharded.pin_ = config.pin_threads_;
+  sharded.page_kind_ = client.page_kind_;
+  int ret = sharded.Init(ShardedClient::ParseMode(config.shard_mode_),
+                         thread_counts.back(), config.protocol_, config.port_,
+                         config.my_ip_, config.max_msg_size_,
+                         client.progress_, client.cq_attr.wait_obj);
+  if (ret) {
+    return ret;
+  }
+  printf("# sharded message rate (mode: %s, size: %zu, window: %zu)\n",
+         config.shard_mode_.c_str(), msg_size, window);
+  printf("%8s %14s %14s\n", "threads", "Mmsg/s", "Mmsg/s/thread");
+  for (size_t num_threads : thread_counts) {
+    double rate;
+    ret = sharded.MsgRate(num_threads, msg_size, window, config.warmup_, rate);
+    if (ret == 0) {
+      ret = sharded.MsgRate(num_threads, msg_size, window,
+                            config.iterations_, rate);
+    }
+    if (ret) {
+      HELOG(kError, "Sharded run failed with {} threads", num_threads);
+      return ret;
+    }
+    printf("%8zu %14.3f %14.3f\n", num_threads, rate / 1e6,
+           rate / 1e6 / num_threads);
+  }
+  return sharded.Stop();
+}
+
+/**
+ * Incast: N clients stream to the server on "port" at once, for each N
+ * in incast_clients. Reports aggregate rate, fairness across clients
+ * (Jain's index and the slowest / fastest client), the latency of N
+ * concurrent ping-pongs, and the server's CPU use while streaming.
+ * "recv" names the server's receive mode on that port.
+ * */
+int IncastSweep(SocketClient &client, ConfigManager &config, int port,
+                const char *recv) {
+  IncastClient incast;
+  MsgBenchClient control(&client);
+  size_t msg_size = std::max<size_t>(config.min_msg_size_, 1);
+  size_t window = config.windows_.back();
+  incast.page_kind_ = client.page_kind_;
+  incast.progress_ = client.progress_;
+  incast.wait_obj_ = client.cq_attr.wait_obj;
+  printf("# incast (provider: %s, recv: %s, size: %zu, window: %zu)\n",
+         config.protocol_.c_str(), recv, msg_size, window);
+  printf("%8s %12s %10s %10s %12s %12s %10s %10s %10s %10s\n", "clients",
+         "Mmsg/s", "GB/s", "fairness", "min Mmsg/s", "max Mmsg/s",
+         "p50(us)", "p99(us)", "p99.9(us)", "srv cpu(%)");
+  for (size_t num_clients : config.incast_clients_) {
+    std::vector<double> rates;
+    LatencyHistogram hist;
+    uint64_t nsec, cpu_start, cpu_end;
+    int ret = incast.Grow(num_clients, config.protocol_, port,
+                          config.my_ip_, config.max_msg_size_);
+    if (ret == 0) {
+      ret = incast.Stream(num_clients, msg_size, window, config.warmup_,
+                          rates, nsec);
+    }
+    if (ret == 0) {
+      ret = control.ServerCpu(cpu_start);
+    }
+    uint64_t start = NowNsec();
+    if (ret == 0) {
+      ret = incast.Stream(num_clients, msg_size, window, config.iterations_,
+                          rates, nsec);
+    }
+    uint64_t wall = std::max<uint64_t>(NowNsec() - start, 1);
+    if (ret == 0) {
+      ret = control.ServerCpu(cpu_end);
+    }
+    if (ret == 0) {
+      ret = incast.PingPong(num_clients, msg_size, config.warmup_,
+                            config.iterations_, hist);
+    }
+    if (ret) {
+      HELOG(kError, "Incast failed with {} clients", num_clients);
+      return ret;
+    }
+    double total = 1e9 * num_clients * config.iterations_ / nsec;
+    printf("%8zu %12.3f %10.3f %10.3f %12.3f %12.3f %10.2f %10.2f %10.2f "
+           "%10.1f\n", num_clients, total / 1e6, total * msg_size / 1e9,
+           IncastClient::JainIndex(rates),
+           *std::min_element(rates.begin(), rates.end()) / 1e6,
+           *std::max_element(rates.begin(), rates.end()) / 1e6,
+           hist.Percentile(50) / 1000.0, hist.Percentile(99) / 1000.0,
+           hist.Percentile(99.9) / 1000.0,
+           100.0 * (cpu_end - cpu_start) / wall);
+  }
+  return incast.Stop();
+}
+
+/** Sweep fi_write & fi_read latency and windowed bandwidth */
+int RmaSweep(SocketClient &client, ConfigManager &config) {
+  RdmaClient rdma;
+  LatencyHistogram hist;
+  int ret = rdma.ClientInit(&client, config.rma_region_size_);
+  if (ret) {
+    return ret;
+  }
+  printf("# RMA (provider: %s, region: %zu, pages: %s)\n",
+         config.protocol_.c_str(), rdma.remote_.size_,
+         PageBuffer::KindName(rdma.data_.kind_));
+  printf("%6s %12s %8s %10s %10s %10s %12s %12s\n",
+         "op", "size(B)", "window", "iters", "p50(us)", "p99(us)",
+         "GB/s", "Mops/s");
+  for (bool write : {true, false}) {
+    const char *op = write ? "write" : "read";
+    for (size_t msg_size : config.GetMsgSizes()) {
+      if (!rdma.Fits(msg_size)) {
+        continue;
+      }
+      ret = rdma.Latency(write, msg_size, config.warmup_,
+                         config.iterations_, hist);
+      if (ret) {
+        HELOG(kError, "RMA {} latency failed at size {}", op, msg_size);
+        return ret;
+      }
+      for (size_t window : config.windows_) {
+        uint64_t nsec;
+        ret = rdma.Bandwidth(write, msg_size, window, config.warmup_, nsec);
+        if (ret == 0) {
+          ret = rdma.Bandwidth(write, msg_size, window,
+                               config.iterations_, nsec);
+        }
+        if (ret) {
+          HELOG(kError, "RMA {} bandwidth failed at size {}", op, msg_size);
+          return ret;
+        }
+        double bytes = static_cast<double>(msg_size) * config.iterations_;
+        printf("%6s %12zu %8zu %10zu %10.2f %10.2f %12.3f %12.3f\n",
+               op, msg_size, window, config.iterations_,
+               hist.Percentile(50) / 1000.0, hist.Percentile(99) / 1000.0,
+               bytes / nsec, config.iterations_ * 1000.0 / nsec);
+      }
+    }
+  }
+  return 0;
+}
+
+/**
+ * Stream from a rotating set of user buffers, registering each send
+ * either per operation or through an MrCache. One send is in flight at
+ * a time so a per-op registration can be closed before the next. With
+ * rma, RMA writes from the same buffers are compared the same way.
+ * */
+int MrCacheSweep(SocketClient &client, ConfigManager &config) {
+  MsgBenchClient bench(&client);
+  RdmaClient rdma;
+  MrCache cache(client.domain_, config.mr_cache_bytes_);
+  std::vector<std::vector<char>> bufs(config.mr_bench_buffers_);
+  int ret = 0;
+  if (config.rma_) {
+    ret = rdma.ClientInit(&client, config.rma_region_size_);
+    if (ret) {
+      return ret;
+    }
+  }
+  printf("# registration cost (%zu buffers, cache cap: %zu)\n",
+         bufs.size(), config.mr_cache_bytes_);
+  printf("%6s %12s %14s %14s %10s %10s\n", "op", "size(B)",
+         "per-op Mmsg/s", "cached Mmsg/s", "speedup", "hit rate");
+  client.mr_cache_ = &cache;
+  for (bool rma : {false, true}) {
+    if (rma && !config.rma_) {
+      continue;
+    }
+    const char *op = rma ? "write" : "send";
+    // Stream "post(i)" one op at a time, over messages or RMA writes
+    auto run = [&](size_t msg_size, uint64_t &nsec, auto &&post) {
+      return rma ? rdma.BandwidthWith(1, config.iterations_, nsec, post) :
+          bench.StreamWith(msg_size, 1, config.iterations_, nsec, post);
+    };
+    for (size_t msg_size : config.GetMsgSizes()) {
+      if (rma && !rdma.Fits(msg_size)) {
+        continue;
+      }
+      cache.Clear();
+      cache.ResetStats();
+      for (std::vector<char> &buf : bufs) {
+        buf.resize(msg_size);
+      }
+
+      // Register & deregister around every op
+      uint64_t per_op_nsec;
+      struct fid_mr *mr = nullptr;
+      ret = run(msg_size, per_op_nsec, [&](size_t i) {
+        if (mr) {
+          fi_close(&mr->fid);
+        }
+        char *buf = bufs[i % bufs.size()].data();
+        int rc = fi_mr_reg(client.domain_, buf, msg_size,
+                           rma ? FI_WRITE : FI_SEND, 0, 0, 0, &mr, NULL);
+        if (rc) {
+          mr = nullptr;
+          return rc;
+        }
+        return rma ? rdma.PostRma(true, buf, msg_size, fi_mr_desc(mr), 0) :
+            client.PostSend(buf, msg_size, fi_mr_desc(mr));
+      });
+      if (mr) {
+        fi_close(&mr->fid);
+      }
+
+      // Look each buffer up in the cache
+      uint64_t cached_nsec;
+      if (ret == 0) {
+        ret = run(msg_size, cached_nsec, [&](size_t i) {
+          char *buf = bufs[i % bufs.size()].data();
+          return rma ? rdma.PostRmaBuf(true, buf, msg_size, 0) :
+              client.PostSendBuf(buf, msg_size);
+        });
+      }
+      if (ret) {
+        HELOG(kError, "Registration benchmark ({}) failed at size {}", op,
+              msg_size);
+        break;
+      }
+      double per_op = config.iterations_ * 1000.0 / per_op_nsec;
+      double cached = config.iterations_ * 1000.0 / cached_nsec;
+      printf("%6s %12zu %14.3f %14.3f %10.2f %10.3f\n", op, msg_size, per_op,
+             cached, cached / per_op, cache.HitRate());
+    }
+    if (ret) {
+      break;
+    }
+  }
+  client.mr_cache_ = nullptr;
+  return ret;
+}
+
+/**
+ * Compare the message rate of fi_send & fi_inject for each message
+ * size the provider can inject.
+ * */
+int InjectSweep(SocketClient &client, ConfigManager &config) {
+  MsgBenchClient bench(&client);
+  size_t window = config.windows_.back();
+  bool inject = client.inject_;
+  printf("# inject vs send (inject_size: %zu, window: %zu)\n",
+         client.InjectSize(), window);
+  printf("%12s %14s %14s %10s\n",
+         "size(B)", "send Mmsg/s", "inject Mmsg/s", "speedup");
+  for (size_t msg_size : config.GetMsgSizes()) {
+    if (msg_size > client.InjectSize()) {
+      break;
+    }
+    double rates[2];
+    for (int use_inject = 0; use_inject < 2; ++use_inject) {
+      uint64_t nsec;
+      client.inject_ = use_inject;
+      int ret = bench.Stream(msg_size, window, config.warmup_, nsec);
+      if (ret == 0) {
+        ret = bench.Stream(msg_size, window, config.iterations_, nsec);
+      }
+      if (ret) {
+        HELOG(kError, "Inject benchmark failed at size {}", msg_size);
+        client.inject_ = inject;
+        return ret;
+      }
+      rates[use_inject] = config.iterations_ * 1000.0 / nsec;
+    }
+    printf("%12zu %14.3f %14.3f %10.2f\n", msg_size, rates[0], rates[1],
+           rates[1] / rates[0]);
+  }
+  client.inject_ = inject;
+  return 0;
+}
+
+/**
+ * Compare counting send & RMA completions with a fid_cntr against
+ * reaping one CQ entry per op. Opens a second connection whose ops are
+ * counted, then runs the same windowed stream (and RMA writes) on both.
+ * */
+int CntrSweep(SocketClient &client, ConfigManager &config) {
+  SocketClient counted;
+  counted.cq_attr.wait_obj = client.cq_attr.wait_obj;
+  counted.progress_ = client.progress_;
+  counted.use_cntr_ = true;
+  int ret = counted.ClientInit(client);
+  if (ret == 0) {
+    // Injected sends are not reliably counted, so always post them
+    counted.inject_ = false;
+    ret = counted.RegisterBuffers(config.max_msg_size_);
+  }
+  if (ret) {
+    HELOG(kError, "Failed to open the counter connection");
+    return ret;
+  }
+  SocketClient *conns[2] = {&client, &counted};
+  RdmaClient rdma[2];
+  if (config.rma_) {
+    for (int i = 0; i < 2; ++i) {
+      ret = rdma[i].ClientInit(conns[i], config.rma_region_size_);
+      if (ret) {
+        return ret;
+      }
+    }
+  }
+  size_t window = config.windows_.back();
+  printf("# counter vs CQ completions (window: %zu)\n", window);
+  printf("%6s %12s %14s %14s %10s\n",
+         "op", "size(B)", "cq Mops/s", "cntr Mops/s", "speedup");
+  for (bool rma : {false, true}) {
+    if (rma && !config.rma_) {
+      break;
+    }
+    for (size_t msg_size : config.GetMsgSizes()) {
+      if (rma && !rdma[0].Fits(msg_size)) {
+        continue;
+      }
+      double rates[2];
+      for (int i = 0; i < 2; ++i) {
+        uint64_t nsec;
+        MsgBenchClient bench(conns[i]);
+        for (size_t iters : {config.warmup_, config.iterations_}) {
+          ret = rma ?
+              rdma[i].Bandwidth(true, msg_size, window, iters, nsec) :
+              bench.Stream(msg_size, window, iters, nsec);
+          if (ret) {
+            HELOG(kError, "Counter benchmark failed at size {}", msg_size);
+            return ret;
+          }
+        }
+        rates[i] = config.iterations_ * 1000.0 / nsec;
+      }
+      printf("%6s %12zu %14.3f %14.3f %10.2f\n", rma ? "write" : "send",
+             msg_size, rates[0], rates[1], rates[1] / rates[0]);
+    }
+  }
+  return MsgBenchClient(&counted).Stop();
+}
+
+/**
+ * Benchmark every host in host_names_ from one RDM endpoint. Each peer
+ * costs an AV entry and a hello rather than a connection; the time and
+ * memory that costs per peer is reported before the benchmarks.
+ * */
+int RdmSweep(SocketClient &client, ConfigManager &config) {
+  int ret;
+  size_t rss = ResidentBytes();
+  uint64_t start = NowNsec();
+  ret = client.InsertPeers(config.host_names_);
+  if (ret) {
+    return ret;
+  }
+  uint64_t insert_nsec = NowNsec() - start;
+  for (fi_addr_t peer : client.peers_) {
+    client.peer_ = peer;
+    ret = MsgBenchClient(&client).Hello();
+    if (ret) {
+      HELOG(kError, "Hello to peer {} failed", peer);
+      return ret;
+    }
+  }
+  uint64_t hello_nsec = NowNsec() - start - insert_nsec;
+  size_t peer_rss = ResidentBytes();
+  peer_rss = peer_rss > rss ? peer_rss - rss : 0;
+  size_t num_peers = std::max<size_t>(client.peers_.size(), 1);
+  printf("# RDM setup (provider: %s, peers: %zu)\n",
+         config.protocol_.c_str(), client.peers_.size());
+  printf("%16s %16s %16s\n", "av_insert(us)", "hello(us)", "rss(B)");
+  printf("%16.2f %16.2f %16zu  per peer\n",
+         insert_nsec / 1000.0 / num_peers, hello_nsec / 1000.0 / num_peers,
+         peer_rss / num_peers);
+
+  for (size_t i = 0; i < client.peers_.size(); ++i) {
+    printf("# peer %zu: %s\n", i, config.host_names_[i].c_str());
+    client.peer_ = client.peers_[i];
+    ret = PingPongSweep(client, config);
+    if (ret == 0) {
+      ret = StreamSweep(client, config);
+    }
+    if (ret == 0 && config.rma_) {
+      ret = RmaSweep(client, config);
+    }
+    if (ret) {
+      return ret;
+    }
+    ret = MsgBenchClient(&client).Stop();
+    if (ret) {
+      return ret;
+    }
+  }
+  return 0;
+}
+
+/**
+ * With protocol "auto", send each message size over the fastest
+ * provider of its size class: one connection per route, each to the
+ * route's own server. Prints ping-pong latency & streamed bandwidth.
+ * */
+int RouteSweep(ProviderRouter &router, ConfigManager &config) {
+  std::vector<std::unique_ptr<SocketClient>> conns;
+  for (size_t i = 0; i < router.routes_.size(); ++i) {
+    auto conn = std::make_unique<SocketClient>();
+    conn->cq_attr.wait_obj = CqProgress::WaitObj(config.cq_policies_);
+    conn->progress_.policy_ = CqProgress::ParsePolicy(config.cq_policies_[0]);
+    conn->progress_.spin_nsec_ = config.cq_spin_us_ * 1000;
+    conn->page_kind_ = PageBuffer::ParseKind(config.page_size_);
+    int ret = ProviderProbe::Connect(*conn, router.routes_[i].target_,
+                                     config.GetRoutePort(i), config.my_ip_,
+                                     config.max_msg_size_);
+    if (ret) {
+      HELOG(kError, "Could not reach {} on port {}: does the server use "
+            "the same provider_table?", router.routes_[i].target_.provider_,
+            config.GetRoutePort(i));
+      return ret;
+    }
+    conns.emplace_back(std::move(conn));
+  }
+  size_t window = config.windows_.back();
+  LatencyHistogram hist;
+  printf("# routed by size class (%zu routes, window: %zu)\n",
+         conns.size(), window);
+  printf("%12s %20s %6s %10s %10s %12s\n", "size(B)", "provider", "ep",
+         "p50(us)", "p99(us)", "GB/s");
+  for (size_t msg_size : config.GetMsgSizes()) {
+    size_t route = router.Find(msg_size);
+    MsgBenchClient bench(conns[route].get());
+    uint64_t nsec = 1;
+    int ret = bench.PingPong(msg_size, config.warmup_, config.iterations_,
+                             hist);
+    if (ret == 0) {
+      ret = bench.Stream(msg_size, window, config.warmup_, nsec);
+    }
+    if (ret == 0) {
+      ret = bench.Stream(msg_size, window, config.iterations_, nsec);
+    }
+    if (ret) {
+      HELOG(kError, "Routed run failed at size {}", msg_size);
+      return ret;
+    }
+    const ProbeTarget &target = router.routes_[route].target_;
+    printf("%12zu %20s %6s %10.2f %10.2f %12.3f\n", msg_size,
+           target.provider_.c_str(), target.ep_type_.c_str(),
+           hist.Percentile(50) / 1000.0, hist.Percentile(99) / 1000.0,
+           static_cast<double>(msg_size) * config.iterations_ / nsec);
+  }
+  for (auto &conn : conns) {
+    int ret = MsgBenchClient(conn.get()).Stop();
+    if (ret) {
+      return ret;
+    }
+  }
+  return 0;
+}
 
 int main(int argc, char **argv) {
   if (argc != 2) {
@@ -14,8 +541,81 @@ int main(int argc, char **argv) {
   std::string real_path = argv[1];
   ConfigManager config;
   config.Load(real_path);
+  ProviderRouter router;
+  if (config.protocol_ == "auto" && !router.Load(config)) {
+    exit(1);
+  }
+  if (!ResolveProvider(config)) {
+    exit(1);
+  }
 
   SocketClient client;
-  client.ClientInit(config.protocol_, config.port_, config.my_ip_);
+  client.cq_attr.wait_obj = CqProgress::WaitObj(config.cq_policies_);
+  client.progress_.policy_ = CqProgress::ParsePolicy(config.cq_policies_[0]);
+  client.progress_.spin_nsec_ = config.cq_spin_us_ * 1000;
+  if (config.rma_) {
+    client.caps_ |= FI_RMA;
+  }
+  client.page_kind_ = PageBuffer::ParseKind(config.page_size_);
+  client.inject_ = config.inject_;
+  client.ep_type_ = SocketClient::ParseEpType(config.ep_type_);
+  size_t rss = ResidentBytes();
+  uint64_t start = NowNsec();
+  if (client.ClientInit(config.protocol_, config.port_, config.my_ip_)) {
+    exit(1);
+  }
+  if (client.RegisterBuffers(config.max_msg_size_)) {
+    exit(1);
+  }
+  size_t setup_rss = ResidentBytes();
+  printf("# setup (ep: %s): %.2f us, %zu B rss\n", config.ep_type_.c_str(),
+         (NowNsec() - start) / 1000.0, setup_rss > rss ? setup_rss - rss : 0);
+  if (client.ep_type_ == FI_EP_RDM) {
+    int ret = RdmSweep(client, config);
+    if (ret == 0 && !router.routes_.empty()) {
+      ret = RouteSweep(router, config);
+    }
+    return ret ? 1 : 0;
+  }
+  if (PingPongSweep(client, config)) {
+    exit(1);
+  }
+  if (StreamSweep(client, config)) {
+    exit(1);
+  }
+  if (!config.shard_mode_.empty()) {
+    if (ShardSweep(client, config)) {
+      exit(1);
+    }
+  }
+  if (!config.incast_clients_.empty()) {
+    bool multi = config.multi_recv_ && !config.multi_recv_compare_;
+    if (IncastSweep(client, config, config.port_,
+                    multi ? "multi" : "per-message")) {
+      exit(1);
+    }
+    // The server's CPU use is read over "client", since both
+    // receive modes are served by the same process
+    if (config.multi_recv_compare_ &&
+        IncastSweep(client, config, config.port_ + 1, "multi")) {
+      exit(1);
+    }
+  }
+  if (config.rma_ && RmaSweep(client, config)) {
+    exit(1);
+  }
+  if (config.inject_bench_ && InjectSweep(client, config)) {
+    exit(1);
+  }
+  if (config.cntr_bench_ && CntrSweep(client, config)) {
+    exit(1);
+  }
+  if (config.mr_bench_buffers_ && MrCacheSweep(client, config)) {
+    exit(1);
+  }
+  if (!router.routes_.empty() && RouteSweep(router, config)) {
+    exit(1);
+  }
+  MsgBenchClient(&client).Stop();
   return 0;
 }
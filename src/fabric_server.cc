@@ -5,9 +5,52 @@
 #include "fabric_bench/config_manager.h"
 #include "fabric_bench/socket_client.h"
 #include "fabric_bench/socket_server.h"
+#include "fabric_bench/provider_probe.h"
 
-void Server() {
+#include <csignal>
+#include <list>
 
+/**
+ * Servers stopped by SIGINT or SIGTERM, the only way out with
+ * num_clients: 0
+ * */
+static std::vector<SocketServer*> g_servers;
+
+static void OnSignal(int) {
+  for (SocketServer *server : g_servers) {
+    server->stop_ = true;
+  }
+}
+
+/**
+ * Start a server of "target" on "port" which stops after "num_clients"
+ * clients, receiving with FI_MULTI_RECV if "multi_recv"
+ * */
+int StartServer(SocketServer &server, ConfigManager &config,
+                const ProbeTarget &target, int port, size_t num_clients,
+                bool multi_recv) {
+  server.cq_wait_obj_ = CqProgress::WaitObj(config.cq_policies_);
+  server.num_workers_ = config.progress_threads_;
+  server.num_clients_ = num_clients;
+  server.page_kind_ = PageBuffer::ParseKind(config.page_size_);
+  server.ep_type_ = SocketClient::ParseEpType(target.ep_type_);
+  server.poll_all_ = config.server_poll_all_ ||
+      !config.incast_clients_.empty();
+  if (multi_recv) {
+    server.caps_ |= FI_MULTI_RECV;
+    server.multi_recv_size_ = config.multi_recv_size_;
+    server.multi_recv_count_ = config.multi_recv_count_;
+  }
+  if (config.rma_) {
+    server.caps_ |= FI_RMA;
+    server.rma_region_size_ = config.rma_region_size_;
+  }
+  int ret = server.ServerInit(target.provider_, port, config.my_ip_,
+                             config.max_msg_size_);
+  if (ret == 0) {
+    g_servers.push_back(&server);
+  }
+  return ret;
 }
 
 int main(int argc, char **argv) {
@@ -18,8 +61,43 @@ int main(int argc, char **argv) {
   std::string real_path = argv[1];
   ConfigManager config;
   config.Load(real_path);
+  ProviderRouter router;
+  if (config.protocol_ == "auto" && !router.Load(config)) {
+    exit(1);
+  }
+  if (!ResolveProvider(config)) {
+    exit(1);
+  }
+  ProbeTarget target = {config.protocol_, config.ep_type_};
 
-  SocketServer server;
-  server.ServerInit(config.protocol_, config.port_, config.my_ip_);
+  // With multi_recv_compare, port serves per-message receives and
+  // port + 1 serves the incast sweep's multi-receive run, whose clients
+  // all stop together
+  bool compare = config.multi_recv_compare_ && !config.incast_clients_.empty();
+  SocketServer server, multi_server;
+  if (StartServer(server, config, target, config.port_, config.num_clients_,
+                  config.multi_recv_ && !compare)) {
+    exit(1);
+  }
+  if (compare) {
+    if (StartServer(multi_server, config, target, config.port_ + 1, 1,
+                    true)) {
+      exit(1);
+    }
+  }
+  // With protocol "auto", each provider route also gets its own server
+  std::list<SocketServer> route_servers;
+  for (size_t i = 0; i < router.routes_.size(); ++i) {
+    route_servers.emplace_back();
+    if (StartServer(route_servers.back(), config, router.routes_[i].target_,
+                    config.GetRoutePort(i), config.num_clients_, false)) {
+      exit(1);
+    }
+  }
+  std::signal(SIGINT, OnSignal);
+  std::signal(SIGTERM, OnSignal);
+  for (SocketServer *started : g_servers) {
+    started->Join();
+  }
   return 0;
 }
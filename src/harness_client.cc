@@ -0,0 +1,236 @@
+//
+// Created by lukemartinlogan on 10/17/23.
+//
+
+#include "fabric_bench/config_manager.h"
+#include "fabric_bench/harness.h"
+
+/**
+ * The connections to one (provider, transport) server. Each thread of
+ * the matrix drives a transport of its own: its own connection for
+ * "msg" & "rma", or its own calls on a shared Thallium client.
+ * */
+struct HarnessPoint {
+  std::string transport_;
+  std::string provider_;
+  int port_;
+  std::vector<std::unique_ptr<SocketClient>> clients_;
+  std::vector<std::unique_ptr<RdmaClient>> rdma_;
+  std::unique_ptr<labstor::RpcContext> ctx_;
+  std::unique_ptr<labstor::ThalliumRpc> rpc_;
+  std::vector<std::unique_ptr<HarnessTransport>> transports_;
+
+  HarnessPoint(const std::string &transport, const std::string &provider,
+               int port)
+      : transport_(transport), provider_(provider), port_(port) {}
+
+  /**
+   * Open transports until there are "count". An RDM server serves one
+   * client at a time, so "rdm" only ever opens one.
+   * */
+  int Open(size_t count, ConfigManager &config) {
+    if (transport_ == "rdm" && count > 1) {
+      HILOG(kWarning, "rdm serves one client at a time, running 1 thread");
+      count = 1;
+    }
+    while (transports_.size() < count) {
+      int ret = transport_ == "thallium" ? OpenThallium(config) :
+          OpenSocket(config);
+      if (ret) {
+        return ret;
+      }
+    }
+    return 0;
+  }
+
+  /** The first "count" transports */
+  std::vector<HarnessTransport*> Get(size_t count) {
+    std::vector<HarnessTransport*> transports;
+    for (size_t i = 0; i < count && i < transports_.size(); ++i) {
+      transports.push_back(transports_[i].get());
+    }
+    return transports;
+  }
+
+  /** Tell the server every transport is done */
+  int Stop() {
+    int ret = 0;
+    for (size_t i = 0; i < transports_.size(); ++i) {
+      // NOTE(llogan): one "Stop" shuts the whole Thallium server down
+      if (transport_ == "thallium" && i > 0) {
+        break;
+      }
+      int rc = transports_[i]->Stop();
+      ret = ret ? ret : rc;
+    }
+    if (rpc_) {
+      rpc_->Finalize();
+    }
+    return ret;
+  }
+
+ private:
+  /** Open a SocketClient for the "msg", "rma" or "rdm" transport */
+  int OpenSocket(ConfigManager &config) {
+    auto client = std::make_unique<SocketClient>();
+    client->cq_attr.wait_obj = CqProgress::WaitObj(config.cq_policies_);
+    client->progress_.policy_ =
+        CqProgress::ParsePolicy(config.cq_policies_[0]);
+    client->progress_.spin_nsec_ = config.cq_spin_us_ * 1000;
+    client->page_kind_ = PageBuffer::ParseKind(config.page_size_);
+    client->inject_ = config.inject_;
+    if (transport_ == "rma") {
+      client->caps_ |= FI_RMA;
+    }
+    client->ep_type_ = transport_ == "rdm" ? FI_EP_RDM : FI_EP_MSG;
+    int ret = client->ClientInit(provider_, port_, config.my_ip_);
+    if (ret == 0) {
+      ret = client->RegisterBuffers(config.max_msg_size_);
+    }
+    if (ret == 0 && client->ep_type_ == FI_EP_RDM) {
+      ret = client->InsertPeers({config.my_ip_});
+      if (ret == 0) {
+        client->peer_ = client->peers_[0];
+        ret = MsgBenchClient(client.get()).Hello();
+      }
+    }
+    if (ret) {
+      return ret;
+    }
+    if (transport_ == "rma") {
+      auto rdma = std::make_unique<RdmaClient>();
+      ret = rdma->ClientInit(client.get(), config.rma_region_size_);
+      transports_.emplace_back(std::make_unique<RmaTransport>(rdma.get()));
+      rdma_.emplace_back(std::move(rdma));
+    } else {
+      transports_.emplace_back(std::make_unique<MsgTransport>(client.get()));
+    }
+    clients_.emplace_back(std::move(client));
+    return ret;
+  }
+
+  /** Add a transport on the (shared) Thallium client */
+  int OpenThallium(ConfigManager &config) {
+    if (!rpc_) {
+      ctx_ = std::make_unique<labstor::RpcContext>();
+      ctx_->ServerInit(&config);
+      ctx_->protocol_ = provider_;
+      ctx_->port_ = port_;
+      rpc_ = std::make_unique<labstor::ThalliumRpc>();
+      rpc_->ClientInit(ctx_.get());
+      rpc_->InitBulkPools(config.bulk_pool_regions_, config.bulk_pool_size_);
+    }
+    transports_.emplace_back(std::make_unique<ThalliumTransport>(
+        rpc_.get(), ctx_->node_id_, config.max_msg_size_));
+    return 0;
+  }
+};
+
+/** Run the suite over one transport of "point" */
+int RunSuite(HarnessPoint &point, ConfigManager &config,
+             HarnessReport &report) {
+  HarnessRow row;
+  row.transport_ = point.transport_;
+  row.provider_ = point.provider_;
+  int ret = point.Open(1, config);
+  if (ret == 0) {
+    ret = RunHarnessSuite(*point.transports_[0], row, config, report);
+  }
+  int stop = point.Stop();
+  return ret ? ret : stop;
+}
+
+/**
+ * Run every (size, threads, iterations, window) point of the matrix on
+ * "point", one row each. Latency does not depend on the window, so it
+ * is measured once per (size, threads, iterations) and repeated in the
+ * row of each window.
+ * */
+int RunMatrix(HarnessPoint &point, ConfigManager &config,
+              HarnessReport &report) {
+  std::vector<size_t> thread_counts = config.GetMatrixThreads();
+  int ret = point.Open(
+      *std::max_element(thread_counts.begin(), thread_counts.end()), config);
+  if (ret) {
+    point.Stop();
+    return ret;
+  }
+  HarnessRow row;
+  row.transport_ = point.transport_;
+  row.provider_ = point.provider_;
+  row.metric_ = "matrix";
+  for (size_t size : config.GetMatrixSizes()) {
+    if (size > point.transports_[0]->MaxSize()) {
+      continue;
+    }
+    for (size_t threads : thread_counts) {
+      if (threads > point.transports_.size()) {
+        continue;
+      }
+      std::vector<HarnessTransport*> transports = point.Get(threads);
+      for (size_t iters : config.GetMatrixIterations()) {
+        LatencyHistogram hist;
+        ret = HarnessLatency(transports, size, config.warmup_, iters, hist);
+        for (size_t window : config.GetMatrixWindows()) {
+          uint64_t nsec = 1;
+          if (ret == 0) {
+            ret = HarnessBandwidth(transports, size, window, config.warmup_,
+                                   nsec);
+          }
+          if (ret == 0) {
+            ret = HarnessBandwidth(transports, size, window, iters, nsec);
+          }
+          if (ret) {
+            HELOG(kError, "Matrix point failed: {} {} size {} window {} "
+                  "threads {}", point.transport_, point.provider_, size,
+                  window, threads);
+            point.Stop();
+            return ret;
+          }
+          double ops = static_cast<double>(iters) * threads;
+          row.size_ = size;
+          row.window_ = window;
+          row.threads_ = threads;
+          row.iters_ = iters;
+          row.p50_us_ = hist.Percentile(50) / 1000.0;
+          row.p99_us_ = hist.Percentile(99) / 1000.0;
+          row.gbps_ = ops * size / nsec;
+          row.mops_ = ops * 1000.0 / nsec;
+          report.Write(row);
+        }
+      }
+    }
+  }
+  return point.Stop();
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    printf("USAGE: ./harness_client <config_file>\n");
+    exit(1);
+  }
+  std::string real_path = argv[1];
+  ConfigManager config;
+  config.Load(real_path);
+
+  HarnessReport report;
+  if (!report.Open(config.harness_output_, real_path, config)) {
+    exit(1);
+  }
+  std::vector<std::string> providers = config.GetHarnessProviders();
+  int failed = 0;
+  for (size_t p = 0; p < providers.size(); ++p) {
+    for (size_t t = 0; t < config.harness_transports_.size(); ++t) {
+      HarnessPoint point(config.harness_transports_[t], providers[p],
+                         config.GetHarnessPort(p, t));
+      int ret = config.matrix_ ? RunMatrix(point, config, report) :
+          RunSuite(point, config, report);
+      if (ret) {
+        HELOG(kError, "Harness {} over {} failed: {}", point.transport_,
+              point.provider_, ret);
+        failed += 1;
+      }
+    }
+  }
+  return failed ? 1 : 0;
+}
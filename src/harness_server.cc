@@ -0,0 +1,113 @@
+//
+// Created by lukemartinlogan on 10/17/23.
+//
+
+#include "fabric_bench/config_manager.h"
+#include "fabric_bench/socket_server.h"
+#include "fabric_bench/rpc_thallium.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using labstor::IoType;
+
+/** One server of the harness, for one (provider, transport) pair */
+struct HarnessServer {
+  std::unique_ptr<SocketServer> socket_;
+  std::unique_ptr<labstor::RpcContext> ctx_;
+  std::unique_ptr<labstor::ThalliumRpc> rpc_;
+  std::vector<char> data_;
+  std::atomic<bool> stopped_ = false;  /**< The client sent "Stop" */
+};
+
+/** Start a SocketServer for the "msg", "rma" or "rdm" transport */
+int StartSocketServer(HarnessServer &server, const std::string &transport,
+                      const std::string &provider, int port,
+                      ConfigManager &config) {
+  server.socket_ = std::make_unique<SocketServer>();
+  SocketServer &socket = *server.socket_;
+  socket.cq_wait_obj_ = CqProgress::WaitObj(config.cq_policies_);
+  socket.num_workers_ = config.progress_threads_;
+  socket.num_clients_ = 1;
+  // NOTE(llogan): matrix threads each open their own connection
+  socket.poll_all_ = true;
+  socket.page_kind_ = PageBuffer::ParseKind(config.page_size_);
+  socket.ep_type_ = transport == "rdm" ? FI_EP_RDM : FI_EP_MSG;
+  if (transport == "rma") {
+    socket.caps_ |= FI_RMA;
+    socket.rma_region_size_ = config.rma_region_size_;
+  }
+  return socket.ServerInit(provider, port, config.my_ip_,
+                           config.max_msg_size_);
+}
+
+/** Start a Thallium server answering "Write" & "Stop" */
+void StartThalliumServer(HarnessServer &server, const std::string &provider,
+                         int port, ConfigManager &config) {
+  server.ctx_ = std::make_unique<labstor::RpcContext>();
+  server.ctx_->ServerInit(&config);
+  server.ctx_->protocol_ = provider;
+  server.ctx_->port_ = port;
+  server.rpc_ = std::make_unique<labstor::ThalliumRpc>();
+  labstor::ThalliumRpc &rpc = *server.rpc_;
+  rpc.ServerInit(server.ctx_.get());
+  rpc.InitBulkPools(config.bulk_pool_regions_, config.bulk_pool_size_);
+  server.data_.resize(config.max_msg_size_);
+  rpc.RegisterRpc("Write", [&server](const tl::request &req,
+                                     const tl::bulk &bulk, size_t size,
+                                     bool pooled) {
+    req.respond(server.rpc_->IoCallServer(req, bulk, IoType::kWrite,
+                                          server.data_.data(), size, pooled));
+  });
+  rpc.RegisterRpc("Stop", [&server](const tl::request &req) {
+    req.respond(0);
+    server.stopped_ = true;
+  });
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    printf("USAGE: ./harness_server <config_file>\n");
+    exit(1);
+  }
+  std::string real_path = argv[1];
+  ConfigManager config;
+  config.Load(real_path);
+
+  // Start every server up front; harness_client visits them in order
+  std::vector<std::string> providers = config.GetHarnessProviders();
+  std::vector<HarnessServer> servers(
+      providers.size() * config.harness_transports_.size());
+  for (size_t p = 0; p < providers.size(); ++p) {
+    for (size_t t = 0; t < config.harness_transports_.size(); ++t) {
+      const std::string &transport = config.harness_transports_[t];
+      int port = config.GetHarnessPort(p, t);
+      HarnessServer &server = servers[p * config.harness_transports_.size()
+                                      + t];
+      if (transport == "thallium") {
+        StartThalliumServer(server, providers[p], port, config);
+      } else if (StartSocketServer(server, transport, providers[p], port,
+                                   config)) {
+        HELOG(kError, "No {} server for {} on port {}", transport,
+              providers[p], port);
+        server.socket_.reset();
+      }
+    }
+  }
+
+  // Wait for each server in the order the client stops them
+  for (HarnessServer &server : servers) {
+    if (server.socket_) {
+      server.socket_->Join();
+    } else if (server.rpc_) {
+      // NOTE(llogan): "Stop" may arrive before this server's turn, so
+      // it only sets a flag rather than finalizing the engine itself
+      while (!server.stopped_) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      server.rpc_->Finalize();
+    }
+  }
+  return 0;
+}
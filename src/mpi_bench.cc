@@ -0,0 +1,204 @@
+//
+// Created by lukemartinlogan on 10/17/23.
+//
+
+#include "fabric_bench/config_manager.h"
+#include "fabric_bench/socket_client.h"
+#include "fabric_bench/socket_server.h"
+#include "fabric_bench/msg_bench.h"
+#include "fabric_bench/comm_pattern.h"
+
+#include <mpi.h>
+
+/** Bytes reserved for each rank's endpoint name */
+static const size_t kMaxNameLen = 256;
+
+/** What one rank measured in one round (or one whole exchange) */
+struct RankResult {
+  double bytes_;   /**< Payload streamed (0 if the rank was idle) */
+  double nsec_;    /**< Time to stream it */
+  double p50_us_;  /**< Ping-pong latency percentiles */
+  double p99_us_;
+};
+
+/**
+ * Run this rank's part of one round: ping-pong, then (once every rank
+ * is ready) stream to "dst". Every rank calls this, even if idle
+ * (dst = -1), since each phase ends with a barrier.
+ * */
+int RunRound(SocketClient &client, std::vector<fi_addr_t> &peers, int dst,
+             size_t msg_size, ConfigManager &config, RankResult &result) {
+  int ret = 0;
+  MsgBenchClient bench(&client);
+  LatencyHistogram hist;
+  if (dst >= 0) {
+    client.peer_ = peers[dst];
+    ret = bench.Hello();
+    if (ret == 0) {
+      ret = bench.PingPong(msg_size, config.warmup_, config.iterations_,
+                           hist);
+    }
+    result.p50_us_ = hist.Percentile(50) / 1000.0;
+    result.p99_us_ = hist.Percentile(99) / 1000.0;
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+  if (dst >= 0 && ret == 0) {
+    uint64_t nsec;
+    size_t window = config.windows_.back();
+    ret = bench.Stream(msg_size, window, config.warmup_, nsec);
+    if (ret == 0) {
+      ret = bench.Stream(msg_size, window, config.iterations_, nsec);
+    }
+    result.bytes_ += static_cast<double>(msg_size) * config.iterations_;
+    result.nsec_ += nsec;
+  }
+  if (dst >= 0) {
+    int stop = bench.Stop();
+    ret = ret ? ret : stop;
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+  return ret;
+}
+
+/**
+ * Gather every rank's result on rank 0 and print one row. The total
+ * bandwidth is all bytes moved over the slowest sender's stream time.
+ * */
+void Report(const char *pattern, const std::string &round, size_t msg_size,
+            RankResult &mine, int rank, int nprocs) {
+  std::vector<RankResult> all(nprocs);
+  MPI_Gather(&mine, sizeof(RankResult), MPI_BYTE, all.data(),
+             sizeof(RankResult), MPI_BYTE, 0, MPI_COMM_WORLD);
+  if (rank != 0) {
+    return;
+  }
+  size_t senders = 0;
+  double bytes = 0, p50 = 0, p99 = 0, max_nsec = 1;
+  double min_gbps = std::numeric_limits<double>::max(), max_gbps = 0;
+  for (RankResult &result : all) {
+    if (result.bytes_ == 0) {
+      continue;
+    }
+    double gbps = result.bytes_ / std::max<double>(result.nsec_, 1);
+    senders += 1;
+    bytes += result.bytes_;
+    p50 += result.p50_us_;
+    p99 = std::max(p99, result.p99_us_);
+    max_nsec = std::max(max_nsec, result.nsec_);
+    min_gbps = std::min(min_gbps, gbps);
+    max_gbps = std::max(max_gbps, gbps);
+  }
+  if (senders == 0) {
+    return;
+  }
+  printf("%10s %6s %12zu %8zu %10.2f %10.2f %10.3f %10.3f %12.3f\n",
+         pattern, round.c_str(), msg_size, senders, p50 / senders, p99,
+         min_gbps, max_gbps, bytes / max_nsec);
+}
+
+int main(int argc, char **argv) {
+  int rank, nprocs;
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+  if (argc != 2) {
+    if (rank == 0) {
+      printf("USAGE: mpirun -n <ranks> ./mpi_bench <config_file>\n");
+    }
+    MPI_Finalize();
+    exit(1);
+  }
+  std::string real_path = argv[1];
+  ConfigManager config;
+  config.Load(real_path);
+
+  // Server role: every rank serves one RDM endpoint on port + rank
+  SocketServer server;
+  server.cq_wait_obj_ = CqProgress::WaitObj(config.cq_policies_);
+  server.num_workers_ = 1;
+  server.num_clients_ = 0;
+  server.page_kind_ = PageBuffer::ParseKind(config.page_size_);
+  server.ep_type_ = FI_EP_RDM;
+  int port = config.port_ + rank;
+  if (server.ServerInit(config.protocol_, port, config.my_ip_,
+                        config.max_msg_size_)) {
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  // Exchange the servers' endpoint names instead of resolving host:port
+  std::vector<char> names(nprocs * kMaxNameLen);
+  char name[kMaxNameLen] = {0};
+  size_t name_len = kMaxNameLen;
+  int ret = fi_getname(&server.clients_.front()->ep_->fid, name, &name_len);
+  if (ret) {
+    HELOG(kError, "Failed to get the endpoint name: {}", fi_strerror(-ret));
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  MPI_Allgather(name, kMaxNameLen, MPI_CHAR, names.data(), kMaxNameLen,
+                MPI_CHAR, MPI_COMM_WORLD);
+
+  // Client role: one RDM endpoint which can reach every rank's server
+  SocketClient client;
+  client.cq_attr.wait_obj = CqProgress::WaitObj(config.cq_policies_);
+  client.progress_.policy_ = CqProgress::ParsePolicy(config.cq_policies_[0]);
+  client.progress_.spin_nsec_ = config.cq_spin_us_ * 1000;
+  client.page_kind_ = PageBuffer::ParseKind(config.page_size_);
+  client.inject_ = config.inject_;
+  client.ep_type_ = FI_EP_RDM;
+  if (client.ClientInit(config.protocol_, port, config.my_ip_) ||
+      client.RegisterBuffers(config.max_msg_size_)) {
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  std::vector<fi_addr_t> peers(nprocs);
+  for (int i = 0; i < nprocs; ++i) {
+    if (client.InsertPeer(names.data() + i * kMaxNameLen, peers[i])) {
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  if (rank == 0) {
+    printf("# MPI patterns (provider: %s, ranks: %d, window: %zu)\n",
+           config.protocol_.c_str(), nprocs, config.windows_.back());
+    printf("%10s %6s %12s %8s %10s %10s %10s %10s %12s\n", "pattern",
+           "round", "size(B)", "senders", "p50(us)", "p99(us)",
+           "min GB/s", "max GB/s", "total GB/s");
+  }
+  for (const std::string &pattern : config.mpi_patterns_) {
+    CommSchedule schedule = {CommSchedule::ParsePattern(pattern), nprocs};
+    for (size_t msg_size : config.GetMsgSizes()) {
+      RankResult total = {};
+      for (int round = 0; round < schedule.NumRounds(); ++round) {
+        RankResult result = {};
+        ret = RunRound(client, peers, schedule.Dest(round, rank), msg_size,
+                       config, result);
+        if (ret) {
+          HELOG(kError, "Rank {} failed {} round {}: {}", rank, pattern,
+                round, fi_strerror(-ret));
+          MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        if (schedule.Aggregate()) {
+          total.bytes_ += result.bytes_;
+          total.nsec_ += result.nsec_;
+          total.p50_us_ = std::max(total.p50_us_, result.p50_us_);
+          total.p99_us_ = std::max(total.p99_us_, result.p99_us_);
+        } else {
+          Report(pattern.c_str(), std::to_string(round + 1), msg_size,
+                 result, rank, nprocs);
+        }
+      }
+      if (schedule.Aggregate()) {
+        Report(pattern.c_str(), "all", msg_size, total, rank, nprocs);
+      }
+    }
+  }
+
+  // Every client has stopped, so the servers can too
+  MPI_Barrier(MPI_COMM_WORLD);
+  server.stop_ = true;
+  for (auto &worker : server.workers_) {
+    worker->thread_.join();
+  }
+  MPI_Finalize();
+  return 0;
+}
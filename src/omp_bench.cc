@@ -0,0 +1,71 @@
+//
+// Created by lukemartinlogan on 10/17/23.
+//
+
+#include "fabric_bench/config_manager.h"
+#include "fabric_bench/socket_client.h"
+#include "fabric_bench/omp_bench.h"
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    printf("USAGE: ./omp_bench <config_file>\n");
+    exit(1);
+  }
+  std::string real_path = argv[1];
+  ConfigManager config;
+  config.Load(real_path);
+  std::vector<size_t> thread_counts = config.GetThreadCounts();
+  size_t msg_size = std::max<size_t>(config.min_msg_size_, 1);
+  size_t window = config.windows_.back();
+
+  // One FI_THREAD_SAFE connection shared by every thread
+  SocketClient shared;
+  shared.cq_attr.wait_obj = CqProgress::WaitObj(config.cq_policies_);
+  shared.progress_.policy_ = CqProgress::ParsePolicy(config.cq_policies_[0]);
+  shared.progress_.spin_nsec_ = config.cq_spin_us_ * 1000;
+  shared.page_kind_ = PageBuffer::ParseKind(config.page_size_);
+  shared.threading_ = FI_THREAD_SAFE;
+  if (shared.ClientInit(config.protocol_, config.port_, config.my_ip_) ||
+      shared.RegisterBuffers(config.max_msg_size_)) {
+    exit(1);
+  }
+
+  // And one connection per thread
+  ShardedClient shards;
+  shards.page_kind_ = shared.page_kind_;
+  if (shards.Init(ShardMode::kEndpoint, thread_counts.back(),
+                  config.protocol_, config.port_, config.my_ip_,
+                  config.max_msg_size_, shared.progress_,
+                  shared.cq_attr.wait_obj)) {
+    exit(1);
+  }
+
+  OmpMsgRate bench(&shared, &shards);
+  omp_set_dynamic(0);
+  printf("# OpenMP message rate (provider: %s, size: %zu, window: %zu)\n",
+         config.protocol_.c_str(), msg_size, window);
+  printf("%8s %14s %14s %12s %12s\n", "threads", "shared Mmsg/s",
+         "per-ep Mmsg/s", "ep wait(%)", "share cost");
+  for (size_t num_threads : thread_counts) {
+    double rates[2], wait_frac[2];
+    for (OmpEpMode mode : {OmpEpMode::kShared, OmpEpMode::kPerThread}) {
+      int i = (int)mode;
+      int ret = bench.Run(mode, (int)num_threads, msg_size, window,
+                          config.warmup_, rates[i], wait_frac[i]);
+      if (ret == 0) {
+        ret = bench.Run(mode, (int)num_threads, msg_size, window,
+                        config.iterations_, rates[i], wait_frac[i]);
+      }
+      if (ret) {
+        HELOG(kError, "OpenMP run failed with {} threads", num_threads);
+        exit(1);
+      }
+    }
+    printf("%8zu %14.3f %14.3f %12.1f %12.2f\n", num_threads,
+           rates[0] / 1e6, rates[1] / 1e6, 100 * wait_frac[0],
+           rates[1] / rates[0]);
+  }
+  shards.Stop();
+  MsgBenchClient(&shared).Stop();
+  return 0;
+}
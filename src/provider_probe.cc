@@ -0,0 +1,44 @@
+//
+// Created by lukemartinlogan on 10/17/23.
+//
+
+#include "fabric_bench/config_manager.h"
+#include "fabric_bench/provider_probe.h"
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    printf("USAGE: ./provider_probe <config_file>\n");
+    exit(1);
+  }
+  std::string real_path = argv[1];
+  ConfigManager config;
+  config.Load(real_path);
+
+  std::vector<ProbeTarget> targets = ProviderProbe::Discover();
+  printf("# providers: %zu (probe: %zu iterations)\n", targets.size(),
+         config.probe_iterations_);
+  ProviderTable table;
+  for (size_t i = 0; i < targets.size(); ++i) {
+    // Each probe gets a fresh port, in case the last one is still closing
+    int ret = ProviderProbe::Probe(targets[i], config.port_ + (int)i, config,
+                                   table.results_);
+    printf("%20s %6s %s\n", targets[i].provider_.c_str(),
+           targets[i].ep_type_.c_str(), ret ? "unavailable" : "probed");
+  }
+  table.Print();
+
+  printf("# selection\n");
+  printf("%12s %20s %6s\n", "size(B)", "provider", "ep");
+  for (size_t size_class : table.SizeClasses()) {
+    ProbeResult best;
+    if (table.Select(size_class, best)) {
+      printf("%12zu %20s %6s\n", size_class, best.provider_.c_str(),
+             best.ep_type_.c_str());
+    }
+  }
+  if (!config.provider_table_.empty() &&
+      !table.Save(config.provider_table_)) {
+    return 1;
+  }
+  return 0;
+}
@@ -2,6 +2,414 @@
 // Created by lukemartinlogan on 9/4/23.
 //
 
-int main() {
+#include "fabric_bench/config_manager.h"
+#include "fabric_bench/rpc_thallium.h"
+#include "fabric_bench/rpc_batch.h"
+#include "fabric_bench/histogram.h"
 
-}
\ No newline at end of file
+#include <deque>
+
+using labstor::IoType;
+using labstor::ThalliumRpc;
+using labstor::u32;
+
+/**
+ * Time one empty RPC at a time, each waited for before the next. Runs
+ * once looking up the server & defining the RPC on every call, then
+ * once with both cached.
+ * */
+void EmptyLatency(ThalliumRpc &rpc, u32 node_id, ConfigManager &config) {
+  LatencyHistogram hist;
+  printf("# empty RPC latency (protocol: %s)\n", config.protocol_.c_str());
+  printf("%8s %10s %10s %10s %10s %10s %10s\n", "cache",
+         "iters", "min(us)", "p50(us)", "p99(us)", "p99.9(us)", "max(us)");
+  for (bool cache : {false, true}) {
+    rpc.cache_rpcs_ = cache;
+    hist.Reset();
+    for (size_t i = 0; i < config.warmup_ + config.iterations_; ++i) {
+      uint64_t start = NowNsec();
+      tl::async_response resp = rpc.AsyncCall(node_id, "Empty");
+      rpc.Wait<int>(resp);
+      if (i >= config.warmup_) {
+        hist.Record(NowNsec() - start);
+      }
+    }
+    printf("%8s %10zu %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+           cache ? "on" : "off", config.iterations_,
+           hist.Min() / 1000.0, hist.Percentile(50) / 1000.0,
+           hist.Percentile(99) / 1000.0, hist.Percentile(99.9) / 1000.0,
+           hist.Max() / 1000.0);
+  }
+}
+
+/** Keep "window" empty RPCs in flight; returns the total time */
+uint64_t EmptyWindow(ThalliumRpc &rpc, u32 node_id, size_t window,
+                     size_t iters) {
+  std::deque<tl::async_response> inflight;
+  window = std::max<size_t>(window, 1);
+  uint64_t start = NowNsec();
+  for (size_t i = 0; i < iters; ++i) {
+    if (inflight.size() == window) {
+      rpc.Wait<int>(inflight.front());
+      inflight.pop_front();
+    }
+    inflight.emplace_back(rpc.AsyncCall(node_id, "Empty"));
+  }
+  for (tl::async_response &resp : inflight) {
+    rpc.Wait<int>(resp);
+  }
+  return NowNsec() - start;
+}
+
+/** Empty RPC throughput with N concurrent AsyncCalls (N from "windows") */
+void EmptyThroughput(ThalliumRpc &rpc, u32 node_id, ConfigManager &config) {
+  printf("# empty RPC throughput (protocol: %s)\n", config.protocol_.c_str());
+  printf("%8s %10s %12s\n", "window", "iters", "Kops/s");
+  for (size_t window : config.windows_) {
+    EmptyWindow(rpc, node_id, window, config.warmup_);
+    uint64_t nsec = EmptyWindow(rpc, node_id, window, config.iterations_);
+    printf("%8zu %10zu %12.3f\n", window, config.iterations_,
+           config.iterations_ * 1e6 / nsec);
+  }
+}
+
+/** Time "iters" synchronous transfers of "size" bytes */
+uint64_t BulkIo(ThalliumRpc &rpc, u32 node_id, const char *op, IoType type,
+                char *data, size_t size, bool pooled, size_t iters,
+                LatencyHistogram &hist) {
+  hist.Reset();
+  uint64_t start = NowNsec();
+  for (size_t i = 0; i < iters; ++i) {
+    uint64_t op_start = NowNsec();
+    size_t io_bytes = rpc.SyncIoCall<size_t>(node_id, op, type, data, size,
+                                             size, pooled);
+    if (io_bytes != size) {
+      HELOG(kFatal, "{} moved {} of {} bytes", op, io_bytes, size);
+    }
+    hist.Record(NowNsec() - op_start);
+  }
+  return std::max<uint64_t>(NowNsec() - start, 1);
+}
+
+/**
+ * Bulk bandwidth of IoCall / IoCallServer: "Write" has the server pull
+ * the client's buffer, "Read" has the server push into it. Each size
+ * runs with both sides exposing per call, then with both sides copying
+ * through their pre-exposed bulk pools (when the size fits).
+ * */
+void BulkBandwidth(ThalliumRpc &rpc, u32 node_id, ConfigManager &config) {
+  std::vector<char> data(config.max_msg_size_);
+  LatencyHistogram hist;
+  printf("# bulk I/O (protocol: %s)\n", config.protocol_.c_str());
+  printf("%6s %6s %12s %10s %10s %10s %12s\n",
+         "op", "pool", "size(B)", "iters", "p50(us)", "p99(us)", "GB/s");
+  for (IoType type : {IoType::kWrite, IoType::kRead}) {
+    const char *op = type == IoType::kWrite ? "Write" : "Read";
+    for (size_t msg_size : config.GetMsgSizes()) {
+      for (bool pooled : {false, true}) {
+        if (pooled && (!rpc.client_pool_ ||
+                       msg_size > rpc.client_pool_->region_size_)) {
+          continue;
+        }
+        rpc.use_bulk_pool_ = pooled;
+        BulkIo(rpc, node_id, op, type, data.data(), msg_size, pooled,
+               config.warmup_, hist);
+        uint64_t nsec = BulkIo(rpc, node_id, op, type, data.data(), msg_size,
+                               pooled, config.iterations_, hist);
+        double bytes = static_cast<double>(msg_size) * config.iterations_;
+        printf("%6s %6s %12zu %10zu %10.2f %10.2f %12.3f\n", op,
+               pooled ? "on" : "off", msg_size, config.iterations_,
+               hist.Percentile(50) / 1000.0, hist.Percentile(99) / 1000.0,
+               bytes / nsec);
+      }
+    }
+  }
+  rpc.use_bulk_pool_ = true;
+}
+
+/**
+ * Transfer & process large payloads whole, then pipelined in chunks of
+ * bulk_chunk_size with bulk_chunk_depth in flight. "ttfb" is how long
+ * until the first chunk was transferred: until the server could start
+ * processing a write, or until the client had the start of a read.
+ * */
+void PipelineBandwidth(ThalliumRpc &rpc, u32 node_id, ConfigManager &config) {
+  std::vector<char> data(config.max_msg_size_);
+  printf("# pipelined bulk I/O (chunk: %zu, depth: %zu)\n",
+         config.bulk_chunk_size_, config.bulk_chunk_depth_);
+  printf("%6s %10s %12s %10s %12s %12s\n",
+         "op", "mode", "size(B)", "iters", "ttfb(us)", "GB/s");
+  rpc.use_bulk_pool_ = false;
+  for (IoType type : {IoType::kWrite, IoType::kRead}) {
+    const char *op = type == IoType::kWrite ? "write" : "read";
+    for (size_t msg_size : config.GetMsgSizes()) {
+      if (msg_size <= config.bulk_chunk_size_) {
+        continue;
+      }
+      for (bool pipelined : {false, true}) {
+        size_t chunk_size = pipelined ? config.bulk_chunk_size_ : 0;
+        uint64_t ttfb = 0, start = 0;
+        for (size_t i = 0; i < config.warmup_ + config.iterations_; ++i) {
+          if (i == config.warmup_) {
+            start = NowNsec();
+          }
+          uint64_t nsec = rpc.SyncIoCall<uint64_t>(
+              node_id, "Process", type, data.data(), msg_size, type,
+              msg_size, chunk_size, config.bulk_chunk_depth_);
+          if (i >= config.warmup_) {
+            ttfb += nsec;
+          }
+        }
+        uint64_t nsec = std::max<uint64_t>(NowNsec() - start, 1);
+        double bytes = static_cast<double>(msg_size) * config.iterations_;
+        printf("%6s %10s %12zu %10zu %12.2f %12.3f\n", op,
+               pipelined ? "pipelined" : "whole", msg_size, config.iterations_,
+               ttfb / 1000.0 / std::max<size_t>(config.iterations_, 1),
+               bytes / nsec);
+      }
+    }
+  }
+  rpc.use_bulk_pool_ = true;
+}
+
+/**
+ * Move "count" scattered segments (each followed by a gap of its own
+ * size) three ways: one scatter-gather bulk, packed into one buffer
+ * first, and one call per segment.
+ * */
+void SgBandwidth(ThalliumRpc &rpc, u32 node_id, ConfigManager &config) {
+  std::vector<char> scattered(2 * config.max_msg_size_);
+  std::vector<char> packed(config.max_msg_size_);
+  printf("# scatter-gather bulk I/O (protocol: %s)\n",
+         config.protocol_.c_str());
+  printf("%6s %8s %10s %12s %10s %12s %12s\n", "op", "mode", "segments",
+         "seg_size(B)", "iters", "p50(us)", "GB/s");
+  rpc.use_bulk_pool_ = false;
+  for (IoType type : {IoType::kWrite, IoType::kRead}) {
+    const char *op = type == IoType::kWrite ? "Write" : "Read";
+    for (size_t count : config.sg_segments_) {
+      for (size_t seg_size : config.GetMsgSizes()) {
+        if (count * seg_size > config.max_msg_size_) {
+          break;
+        }
+        labstor::BulkSegments segments(count);
+        for (size_t i = 0; i < count; ++i) {
+          segments[i].first = scattered.data() + 2 * i * seg_size;
+          segments[i].second = seg_size;
+        }
+        size_t size = count * seg_size;
+        for (std::string mode : {"sg", "pack", "each"}) {
+          auto io = [&]() {
+            size_t io_bytes = 0;
+            if (mode == "sg") {
+              io_bytes = rpc.SgIoCall<size_t>(node_id, "Sg", type, segments,
+                                              type, seg_size, count);
+            } else if (mode == "pack") {
+              // Pack (or unpack) the segments around one contiguous call
+              for (size_t i = 0; type == IoType::kWrite && i < count; ++i) {
+                memcpy(packed.data() + i * seg_size, segments[i].first,
+                       seg_size);
+              }
+              io_bytes = rpc.SyncIoCall<size_t>(node_id, op, type,
+                                                packed.data(), size, size,
+                                                false);
+              for (size_t i = 0; type == IoType::kRead && i < count; ++i) {
+                memcpy(segments[i].first, packed.data() + i * seg_size,
+                       seg_size);
+              }
+            } else {
+              for (auto &segment : segments) {
+                io_bytes += rpc.SyncIoCall<size_t>(
+                    node_id, op, type, (char*)segment.first, seg_size,
+                    seg_size, false);
+              }
+            }
+            if (io_bytes != size) {
+              HELOG(kFatal, "{} moved {} of {} bytes", mode, io_bytes, size);
+            }
+          };
+          LatencyHistogram hist;
+          for (size_t i = 0; i < config.warmup_; ++i) {
+            io();
+          }
+          uint64_t start = NowNsec();
+          for (size_t i = 0; i < config.iterations_; ++i) {
+            uint64_t op_start = NowNsec();
+            io();
+            hist.Record(NowNsec() - op_start);
+          }
+          uint64_t nsec = std::max<uint64_t>(NowNsec() - start, 1);
+          double bytes = static_cast<double>(size) * config.iterations_;
+          printf("%6s %8s %10zu %12zu %10zu %12.2f %12.3f\n", op, mode.c_str(),
+                 count, seg_size, config.iterations_,
+                 hist.Percentile(50) / 1000.0, bytes / nsec);
+        }
+      }
+    }
+  }
+  rpc.use_bulk_pool_ = true;
+}
+
+/**
+ * Batched small calls: "Echo" rpc_batch_payload bytes with up to "window"
+ * calls outstanding, for each batch size & deadline. Latency is from
+ * Call until the call's future is ready, so larger batches and longer
+ * deadlines trade latency for throughput. A batch size of 1 is timed
+ * with plain "Echo" RPCs instead.
+ * */
+void BatchSweep(ThalliumRpc &rpc, u32 node_id, ConfigManager &config) {
+  typedef std::pair<uint64_t, std::future<std::string>> Pending;
+  std::string payload(config.rpc_batch_payload_, 'x');
+  size_t window = config.windows_.back();
+  LatencyHistogram hist;
+  // Keep "window" calls made by "call" in flight; returns the timed nsec
+  auto run = [&](auto &&call) {
+    std::deque<Pending> inflight;
+    auto complete = [&](bool record) {
+      std::string result = inflight.front().second.get();
+      if (result.size() != payload.size()) {
+        HELOG(kFatal, "Echo returned {} of {} bytes", result.size(),
+              payload.size());
+      }
+      if (record) {
+        hist.Record(NowNsec() - inflight.front().first);
+      }
+      inflight.pop_front();
+    };
+    hist.Reset();
+    uint64_t start = 0;
+    for (size_t i = 0; i < config.warmup_ + config.iterations_; ++i) {
+      if (i == config.warmup_) {
+        while (!inflight.empty()) {
+          complete(false);
+        }
+        start = NowNsec();
+      }
+      if (inflight.size() == window) {
+        complete(i >= config.warmup_);
+      }
+      inflight.emplace_back(NowNsec(), call());
+    }
+    while (!inflight.empty()) {
+      complete(true);
+    }
+    return std::max<uint64_t>(NowNsec() - start, 1);
+  };
+  auto print = [&](size_t max_calls, const std::string &deadline,
+                   double per_batch, uint64_t nsec) {
+    printf("%8zu %12s %12.2f %10zu %10.2f %10.2f %12.3f\n", max_calls,
+           deadline.c_str(), per_batch, config.iterations_,
+           hist.Percentile(50) / 1000.0, hist.Percentile(99) / 1000.0,
+           config.iterations_ * 1e6 / nsec);
+  };
+  printf("# batched RPCs (payload: %zu, max bytes: %zu, window: %zu)\n",
+         config.rpc_batch_payload_, config.rpc_batch_bytes_, window);
+  printf("%8s %12s %12s %10s %10s %10s %12s\n", "calls", "deadline(us)",
+         "calls/batch", "iters", "p50(us)", "p99(us)", "Kops/s");
+  for (size_t max_calls : config.rpc_batch_calls_) {
+    if (max_calls <= 1) {
+      // The unbatched baseline: a plain RPC per call, no batcher thread
+      uint64_t nsec = run([&]() {
+        auto resp = std::make_shared<tl::async_response>(
+            rpc.AsyncCall(node_id, "Echo", payload));
+        return std::async(std::launch::deferred, [resp]() {
+          std::string result = resp->wait();
+          return result;
+        });
+      });
+      print(1, "-", 1, nsec);
+      continue;
+    }
+    for (size_t deadline_us : config.rpc_batch_deadlines_us_) {
+      labstor::RpcBatcher batcher(&rpc, max_calls, config.rpc_batch_bytes_,
+                                  deadline_us * 1000);
+      uint64_t nsec = run([&]() {
+        return batcher.Call(node_id, "Echo", payload);
+      });
+      print(max_calls, std::to_string(deadline_us), batcher.CallsPerBatch(),
+            nsec);
+    }
+  }
+}
+
+/**
+ * Sweep Argobots topologies: handler xstreams (rpc_sweep_threads),
+ * with & without a progress xstream, blocking & busy-spinning. Each
+ * point starts a server engine in this process (on its own port) and
+ * times empty RPCs against it, so only this host's topology is varied.
+ * */
+void TopologySweep(ConfigManager &config) {
+  LatencyHistogram hist;
+  size_t window = config.windows_.back();
+  printf("# RPC topology sweep (protocol: %s, window: %zu)\n",
+         config.protocol_.c_str(), window);
+  printf("%8s %9s %6s %10s %10s %10s %12s\n", "threads", "progress",
+         "spin", "pool", "p50(us)", "p99(us)", "Kops/s");
+  for (size_t num_threads : config.rpc_sweep_threads_) {
+    for (bool progress_thread : {false, true}) {
+      for (bool busy_spin : {false, true}) {
+        labstor::RpcContext ctx;
+        ctx.ServerInit(&config);
+        ctx.port_ = config.GetRpcSweepPort();
+        ctx.num_threads_ = (int)num_threads;
+        ctx.progress_thread_ = progress_thread;
+        ctx.busy_spin_ = busy_spin;
+        ThalliumRpc rpc;
+        rpc.ServerInit(&ctx);
+        rpc.RegisterRpc("Empty", [](const tl::request &req) {
+          req.respond(0);
+        });
+        hist.Reset();
+        for (size_t i = 0; i < config.warmup_ + config.iterations_; ++i) {
+          uint64_t start = NowNsec();
+          tl::async_response resp = rpc.AsyncCall(ctx.node_id_, "Empty");
+          rpc.Wait<int>(resp);
+          if (i >= config.warmup_) {
+            hist.Record(NowNsec() - start);
+          }
+        }
+        uint64_t nsec = EmptyWindow(rpc, ctx.node_id_, window,
+                                    config.iterations_);
+        printf("%8zu %9s %6s %10s %10.2f %10.2f %12.3f\n", num_threads,
+               progress_thread ? "yes" : "no", busy_spin ? "yes" : "no",
+               rpc.GetPoolKind().c_str(), hist.Percentile(50) / 1000.0,
+               hist.Percentile(99) / 1000.0, config.iterations_ * 1e6 / nsec);
+        rpc.Finalize();
+      }
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    printf("USAGE: ./thallium_client <config_file>\n");
+    exit(1);
+  }
+  std::string real_path = argv[1];
+  ConfigManager config;
+  config.Load(real_path);
+
+  if (!config.rpc_sweep_threads_.empty()) {
+    TopologySweep(config);
+    return 0;
+  }
+
+  labstor::RpcContext ctx;
+  ctx.ServerInit(&config);
+  ThalliumRpc rpc;
+  rpc.ClientInit(&ctx);
+  rpc.InitBulkPools(config.bulk_pool_regions_, config.bulk_pool_size_);
+
+  for (u32 node_id = 1; node_id <= ctx.GetNumHosts(); ++node_id) {
+    printf("# server %u: %s\n", node_id, rpc.GetServerName(node_id).c_str());
+    EmptyLatency(rpc, node_id, config);
+    EmptyThroughput(rpc, node_id, config);
+    BulkBandwidth(rpc, node_id, config);
+    PipelineBandwidth(rpc, node_id, config);
+    SgBandwidth(rpc, node_id, config);
+    BatchSweep(rpc, node_id, config);
+    tl::async_response resp = rpc.AsyncCall(node_id, "Stop");
+    rpc.Wait<int>(resp);
+  }
+  return 0;
+}
@@ -1,3 +1,110 @@
 //
 // Created by lukemartinlogan on 9/4/23.
 //
+
+#include "fabric_bench/config_manager.h"
+#include "fabric_bench/rpc_thallium.h"
+#include "fabric_bench/rpc_batch.h"
+#include "fabric_bench/histogram.h"
+
+#include <atomic>
+
+using labstor::IoType;
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    printf("USAGE: ./thallium_server <config_file>\n");
+    exit(1);
+  }
+  std::string real_path = argv[1];
+  ConfigManager config;
+  config.Load(real_path);
+
+  labstor::RpcContext ctx;
+  ctx.ServerInit(&config);
+  labstor::ThalliumRpc rpc;
+  rpc.ServerInit(&ctx);
+  rpc.InitBulkPools(config.bulk_pool_regions_, config.bulk_pool_size_);
+
+  // NOTE(llogan): concurrent transfers share one buffer; only the
+  // movement of the bytes is measured, not their contents
+  std::vector<char> data(config.max_msg_size_);
+  std::vector<char> sink(config.max_msg_size_);
+  std::vector<char> scattered(2 * config.max_msg_size_);
+  std::atomic<size_t> num_done = 0;
+
+  rpc.RegisterRpc("Empty", [](const tl::request &req) {
+    req.respond(0);
+  });
+  rpc.RegisterRpc("Write", [&](const tl::request &req, const tl::bulk &bulk,
+                               size_t size, bool pooled) {
+    req.respond(rpc.IoCallServer(req, bulk, IoType::kWrite,
+                                 data.data(), size, pooled));
+  });
+  rpc.RegisterRpc("Read", [&](const tl::request &req, const tl::bulk &bulk,
+                              size_t size, bool pooled) {
+    req.respond(rpc.IoCallServer(req, bulk, IoType::kRead,
+                                 data.data(), size, pooled));
+  });
+  // Transfer "size" bytes & process them (copy between data and sink),
+  // either whole or pipelined in chunks. Replies with the nsec until the
+  // first chunk was transferred: the first bytes the server can process
+  // for writes, or the first the client has for reads.
+  rpc.RegisterRpc("Process", [&](const tl::request &req, const tl::bulk &bulk,
+                                 IoType type, size_t size, size_t chunk_size,
+                                 size_t depth) {
+    uint64_t start = NowNsec();
+    uint64_t first = start;
+    auto process = [&](size_t off, size_t len) {
+      if (type == IoType::kWrite) {
+        memcpy(sink.data() + off, data.data() + off, len);
+      } else {
+        memcpy(data.data() + off, sink.data() + off, len);
+      }
+    };
+    if (chunk_size == 0 || chunk_size >= size) {
+      if (type == IoType::kRead) {
+        process(0, size);
+      }
+      rpc.IoCallServer(req, bulk, type, data.data(), size, false);
+      first = NowNsec();
+      if (type == IoType::kWrite) {
+        process(0, size);
+      }
+    } else {
+      rpc.IoCallServerChunked(req, bulk, type, data.data(), size,
+                              chunk_size, depth, process, first);
+    }
+    req.respond(first - start);
+  });
+  // Scatter-gather "count" segments of "seg_size" bytes, laid out with a
+  // gap of "seg_size" between each, in one bulk operation
+  rpc.RegisterRpc("Sg", [&](const tl::request &req, const tl::bulk &bulk,
+                            IoType type, size_t seg_size, size_t count) {
+    labstor::BulkSegments segments(count);
+    for (size_t i = 0; i < count; ++i) {
+      segments[i].first = scattered.data() + 2 * i * seg_size;
+      segments[i].second = seg_size;
+    }
+    req.respond(rpc.SgIoCallServer(req, bulk, type, segments));
+  });
+  // Small calls which clients may batch, & the same call unbatched
+  rpc.RegisterRpc("Echo", [](const tl::request &req,
+                             const std::string &args) {
+    req.respond(args);
+  });
+  labstor::RpcBatchServer batch;
+  batch.Define("Echo", [](const std::string &args) {
+    return args;
+  });
+  batch.Register(rpc);
+  rpc.RegisterRpc("Stop", [&](const tl::request &req) {
+    req.respond(0);
+    size_t done = num_done.fetch_add(1) + 1;
+    if (config.num_clients_ && done >= config.num_clients_) {
+      rpc.server_engine_->finalize();
+    }
+  });
+  rpc.RunDaemon();
+  return 0;
+}